@@ -0,0 +1,1002 @@
+/*
+ * Host simulator for fm-trcv.c
+ *
+ *  Runs the firmware against a BK4802 register file, an ST7032 display
+ *  and a scripted joystick ladder on AN2, on a simulated microsecond
+ *  clock. Timer0 and ADC interrupts are raised as the clock advances.
+ *
+ *      cc -DSIM_HOST -o fm-sim fm-trcv.c fm-sim.c
+ *      ./fm-sim script.txt [hef.bin]
+ *      ./fm-sim --bench > bench.csv
+ *      ./fm-sim --selftest
+ *
+ *  script: one "<ms> <key>" per line, key O(pen) L R C U D P(tt),
+ *  "<ms> end" (or "end <ms>") stops the run, '#' starts a comment.
+ *  "sig <kHz> <rssi>" puts a carrier on the air, read back through
+ *  the BK4802 RSSI register while the receiver is tuned to it.
+ *  "lad <O> <L> <R> <C> <U> <D> <P>" sets the ladder levels (8 bit hex)
+ *  of another board revision.
+ *  hef.bin holds the 128 HEF bytes across runs, loaded at start when it
+ *  exists and written back at the end.
+ *
+ *  --bench boots the firmware, then calls the radio and LCD paths
+ *  directly and prints one CSV row per scenario: I2C transactions,
+ *  bytes and bits, modelled bus time, the elapsed time up to the last
+ *  queued STOP, blocked_tcy, the instruction cycles the main line
+ *  spent in bus transfers, delay loops and flash writes, and cpu_tcy,
+ *  the cycles of the code itself as charged by the CYC() estimates in
+ *  fm-trcv.c. Transfers the Timer0 interrupt makes count in bus_us
+ *  only, waiting for a tick or in SLEEP is neither. Boot is reported
+ *  twice, up to the first RX frequency write (time to first audio) and
+ *  up to the LCD being on. Instructions take no simulated time.
+ *
+ *  --selftest checks the PLL words from frq_syn() against the ones
+ *  worked out by hand, and pll_chan() against frq_syn() over every
+ *  channel of every band, walking up, down and by random 2 and 10
+ *  channel moves. Exits non-zero on a mismatch.
+ *
+ *  (C)2021 JK1MLY All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_MODEL
+#include "fm-sim.h"
+
+#define I2C_ADR     0x90
+#define I2C_LCD     0x7c
+#define LCD_W       8
+
+#define PLL_REF     1360000000.0
+#define PLL_IF      137000.0
+
+#define SCR_MAX     256
+#define SIG_MAX     16
+#define BAND_CNT    8       // BAND_LIST in fm-trcv.c
+#define HEF_ADR     0x0780
+#define HEF_LEN     128
+#define HEF_ROW     16
+#define HEF_TPEW    2000    // us, row erase or write
+#define SIG_FLOOR   0x0C    // RSSI with no carrier
+#define REG_RSSI    24
+#define REG_NOISE   25
+#define ADC_VIL     0x33    // RA2 digital low, 0.2 VDD
+
+// PIC16F1503 supply current, approximate typical figures at 3V
+#define IDD_RUN     (100 * CLK_MHZ + 200)   // uA, HFINTOSC
+#define IDD_SLP     1                       // uA, SLEEP with WDT
+
+// bit-banged bus timing, us
+#define BUS_START   8
+#define BUS_BYTE    96
+#define BUS_STOP    26
+
+volatile sim_sfr sim_lata;
+volatile sim_sfr sim_trisa;
+volatile sim_sfr sim_porta;
+volatile sim_sfr sim_latc;
+volatile sim_sfr sim_intcon;
+volatile sim_sfr sim_pie1;
+volatile sim_sfr sim_pir1;
+volatile sim_sfr sim_status;
+volatile uint8_t sim_reg[16];
+
+// clock
+uint64_t sim_us;
+uint64_t sim_tick;      // next Timer0 interrupt, us
+uint8_t sim_in_isr;
+
+// joystick
+uint32_t scr_ms[SCR_MAX];
+uint8_t scr_key[SCR_MAX];
+uint16_t scr_len;
+uint16_t scr_pos;
+uint32_t scr_end;
+uint8_t adc_key = 'O';
+#define LAD_KEYS    "OLRCUDP"
+uint8_t lad_lvl[7] = {0xF0, 0xC8, 0xA8, 0x90, 0x50, 0x28, 0x08};
+uint8_t adc_pend;
+
+// BK4802
+uint16_t bk_chip[32];
+uint8_t bk_ptr;
+uint32_t sig_khz[SIG_MAX];
+uint8_t sig_lvl[SIG_MAX];
+uint8_t sig_len;
+
+// HEF, low byte of each word
+uint8_t hef_mem[HEF_LEN];
+const char *hef_file;
+
+// ST7032
+uint8_t lcd_ram[80];
+uint8_t lcd_ac;
+uint8_t lcd_ctl;
+char lcd_log[LCD_W + 1];
+
+// I2C transaction in progress
+uint8_t bus_dev;
+uint8_t bus_cnt;
+uint8_t bus_hi;
+uint8_t bus_rd;
+
+// radio state last printed
+uint16_t rf_log[5];
+
+// bench counters
+uint8_t bench;
+uint32_t cnt_txn;
+uint32_t cnt_byte;
+uint64_t cnt_bus;
+uint64_t cnt_t0;
+uint32_t cnt_tune;      // PLL words written
+uint64_t cnt_slp;       // us in SLEEP
+uint64_t cnt_blk;       // us the main line waits in bus transfers and delays
+uint8_t sim_spn;        // waiting for a tick, not blocked
+uint64_t sim_cyc;       // CYC() estimates of the code run
+uint64_t cnt_cyc;
+uint64_t aud_us;        // first RX REG0 write, counters then
+uint32_t aud_txn;
+uint32_t aud_byte;
+uint64_t aud_bus;
+uint64_t aud_cyc;
+
+// firmware under test
+uint32_t frq_syn(uint8_t tr_mode, uint32_t f_hz, uint8_t div);
+uint32_t frq_hz(uint8_t fr_band, uint8_t fr_chan);
+uint32_t pll_chan(uint8_t tr_mode, uint8_t fr_band, uint8_t fr_chan);
+extern const uint8_t band_chs[];
+extern const uint8_t band_div[];
+extern const uint8_t bcd_up2[3];
+void bcd_add(uint8_t *acc, const uint8_t *add);
+uint8_t sw_lvl(uint8_t cmp_val);
+extern uint8_t fr_band;
+extern uint8_t fr_chan;
+void rcv_set(uint8_t fr_band, uint8_t fr_chan, uint8_t af_vol, uint8_t sq_vol);
+void snd_set(uint8_t fr_band, uint8_t fr_chan, uint8_t po_vol);
+extern uint8_t fr_bcd[3];
+void frq_bcd(uint8_t fr_band, uint8_t fr_chan, uint8_t *bcd);
+void lcd_ch(uint8_t set_md, const uint8_t *bcd);
+void lcd_clr(void);
+void sch_run(void);
+uint8_t bk_rssi(void);
+extern uint8_t scn_st;
+extern uint8_t scn_mem;
+void scn_hop(void);
+extern uint8_t mem_ch[][3];
+void hef_pack(uint8_t *dat);
+extern uint8_t hef_nxt;
+extern uint8_t lcd_stg;
+extern uint8_t flag;
+extern uint8_t set_md;
+extern uint8_t s_timer;
+extern uint8_t sq_vol;
+extern uint8_t lcd_req;
+void pwr_idle(void);
+extern volatile uint8_t i2c_pdone;
+void i2c_wait(void);
+uint8_t sch_due(void);
+void hef_save(uint8_t slot);
+void hef_load(void);
+
+uint16_t sim_tcy(void)
+{
+    return (uint16_t)(sim_us * CLK_MHZ / 4);
+}
+
+uint8_t adc_level(uint8_t key)
+{
+    const char *pos;
+
+    pos = strchr(LAD_KEYS, key);
+    if((pos == NULL) || (key == 0)){
+        pos = LAD_KEYS;
+    }
+    return lad_lvl[pos - LAD_KEYS];
+}
+
+void adc_conv(void)
+{
+    uint16_t val;
+
+    val = (uint16_t)(adc_level(adc_key) << 2);
+    ADRESH = (uint8_t)(val >> 8);
+    ADRESL = (uint8_t)(val & 0xFF);
+}
+
+void sim_adc_start(void)
+{
+    adc_pend = 1;
+}
+
+uint8_t sim_adc_busy(void)
+{
+    sim_wait(12);
+    adc_conv();
+    adc_pend = 0;
+    return 0;
+}
+
+void sim_irq(void)
+{
+    if(sim_in_isr || !GIE){
+        return;
+    }
+    sim_in_isr = 1;
+    if(TMR0IE){
+        TMR0IF = 1;
+        isr();
+    }
+    if(adc_pend && ADIE && PEIE){
+        adc_pend = 0;
+        adc_conv();
+        ADIF = 1;
+        isr();
+    }
+    sim_in_isr = 0;
+}
+
+double rf_mhz(int tx)
+{
+    uint32_t word;
+    double f;
+
+    word = ((uint32_t)bk_chip[0] << 16) | bk_chip[1];
+    f = word * PLL_REF / 4294967296.0;
+    switch (bk_chip[2] & 0xE000){
+        case 0xC000:
+            f /= 16;
+            break;
+        case 0x8000:
+            f /= 9;
+            break;
+        case 0x2000:
+            f /= 3;
+            break;
+        default:
+            ;
+    }
+    if(!tx){
+        f += PLL_IF;
+    }
+    return f / 1e6;
+}
+
+uint8_t rf_rssi(void)
+{
+    long khz;
+
+    if(bk_chip[4] & 0x7C00){
+        return 0;
+    }
+    khz = (long)(rf_mhz(0) * 1000 + 0.5);
+    for(uint8_t lp = 0; lp < sig_len; lp++){
+        if(labs(khz - (long)sig_khz[lp]) <= 5){
+            return sig_lvl[lp];
+        }
+    }
+    return SIG_FLOOR;
+}
+
+uint16_t bk_read(uint8_t adr)
+{
+    switch (adr){
+        case REG_RSSI:
+            return rf_rssi();
+        case REG_NOISE:
+            return (uint16_t)(0x7F - rf_rssi());
+        default:
+            return bk_chip[adr];
+    }
+}
+
+void sim_log(void)
+{
+    char line[LCD_W + 1];
+    int tx;
+
+    memcpy(line, lcd_ram, LCD_W);
+    line[LCD_W] = 0;
+    if(strcmp(line, lcd_log) != 0){
+        strcpy(lcd_log, line);
+        printf("%9.3f LCD \"%s\"\n", sim_us / 1000.0, line);
+    }
+    if(memcmp(rf_log, bk_chip, sizeof(rf_log)) != 0){
+        memcpy(rf_log, bk_chip, sizeof(rf_log));
+        tx = (bk_chip[4] & 0x7C00) != 0;
+        printf("%9.3f BK  %s %.4f MHz  filter %02X\n", sim_us / 1000.0,
+            tx ? "TX" : "RX", rf_mhz(tx), sim_latc.r);
+    }
+}
+
+void sim_wait(uint32_t us)
+{
+    uint64_t end;
+
+    if(!sim_in_isr && !sim_spn){
+        cnt_blk += us;
+    }
+    end = sim_us + us;
+    while(sim_tick <= end){
+        sim_us = sim_tick;
+        sim_tick += 1000;
+        while((scr_pos < scr_len) && (scr_ms[scr_pos] * 1000ULL <= sim_us)){
+            adc_key = scr_key[scr_pos++];
+        }
+        sim_irq();
+    }
+    sim_us = end;
+}
+
+// sch_due() for the simulator's own loops, not charged to the firmware
+uint8_t sim_due(void)
+{
+    uint64_t cyc;
+    uint8_t due;
+
+    cyc = sim_cyc;
+    due = sch_due();
+    sim_cyc = cyc;
+    return due;
+}
+
+// busy loop in the firmware, on to the next tick
+void sim_spin(void)
+{
+    sim_spn = 1;
+    sim_wait((uint32_t)(sim_tick - sim_us));
+    sim_spn = 0;
+}
+
+// Timer0 stops, the WDT or a falling RA2 with IOC armed ends it
+void sim_sleep(void)
+{
+    uint64_t end;
+    uint64_t t0;
+
+    t0 = sim_us;
+    end = (WDTCON & 1) ? sim_us + (1000ULL << (WDTCON >> 1)) : UINT64_MAX;
+    nTO = 1;
+    while(1){
+        while((scr_pos < scr_len) && (scr_ms[scr_pos] * 1000ULL <= sim_us)){
+            adc_key = scr_key[scr_pos++];
+        }
+        if(IOCIE && (IOCAN & 0x04) && !(ANSELA & 0x04) && (adc_level(adc_key) < ADC_VIL)){
+            IOCAF |= 0x04;
+            break;
+        }
+        if(sim_us >= end){
+            nTO = 0;
+            break;
+        }
+        if((scr_pos < scr_len) && (scr_ms[scr_pos] * 1000ULL < end)){
+            sim_us = scr_ms[scr_pos] * 1000ULL;
+        } else if(end == UINT64_MAX){
+            break;      // nothing left to wake it
+        } else {
+            sim_us = end;
+        }
+    }
+    cnt_slp += sim_us - t0;
+    sim_tick = sim_us + 1000;
+}
+
+void b_start(void)
+{
+    i2c_wait();
+    cnt_slp = 0;
+    cnt_blk = 0;
+    cnt_cyc = sim_cyc;
+    cnt_txn = 0;
+    cnt_byte = 0;
+    cnt_bus = 0;
+    cnt_t0 = sim_us;
+}
+
+void b_line(const char *name, uint32_t txn, uint32_t byte, uint64_t bus, uint64_t us,
+    uint64_t blk, uint64_t cyc)
+{
+    printf("%s,%lu,%lu,%lu,%llu,%llu,%llu,%llu\n", name,
+        (unsigned long)txn, (unsigned long)byte,
+        (unsigned long)(byte * 9 + txn * 2),
+        (unsigned long long)bus, (unsigned long long)us,
+        (unsigned long long)(blk * CLK_MHZ / 4), (unsigned long long)cyc);
+}
+
+// the queue drains first, us counts up to its last STOP
+void b_row(const char *name)
+{
+    i2c_wait();
+    b_line(name, cnt_txn, cnt_byte, cnt_bus, sim_us - cnt_t0, cnt_blk, sim_cyc - cnt_cyc);
+}
+
+void b_idle(uint32_t ms)
+{
+    uint64_t end;
+
+    end = sim_us + ms * 1000ULL;
+    while(sim_us < end){
+        sch_run();
+        pwr_idle();
+        if(!sim_due()){
+            sim_spin();
+        }
+    }
+}
+
+// modelled supply current since b_start(), the code run time from the
+// CYC() estimates comes out of the time asleep
+uint64_t b_idd(void)
+{
+    uint64_t all;
+    uint64_t run;
+
+    all = sim_us - cnt_t0;
+    run = sim_us - cnt_t0 - cnt_slp + (sim_cyc - cnt_cyc) * 4 / CLK_MHZ;
+    if(run > all){
+        run = all;
+    }
+    return (IDD_RUN * run + IDD_SLP * (all - run)) / all;
+}
+
+// key on the ladder, main loop until cond() (1s at most), time to it
+uint64_t b_wake(uint8_t key, uint8_t (*cond)(void))
+{
+    uint64_t t0;
+
+    adc_key = key;
+    t0 = sim_us;
+    while(!cond() && (sim_us - t0 < 1000000)){
+        b_idle(1);
+    }
+    return sim_us - t0;
+}
+
+uint8_t b_tx(void)
+{
+    return (flag != 0) && i2c_pdone;
+}
+
+uint8_t b_rx(void)
+{
+    return flag == 0;
+}
+
+uint8_t b_menu(void)
+{
+    return set_md != 0;
+}
+
+uint8_t b_chan(void)
+{
+    return fr_chan == 98;
+}
+
+uint8_t b_sql(void)
+{
+    return sq_vol == 0xFC;
+}
+
+// UP held in menu md from the bottom to cond(), then the release up to
+// the radio taking the new setting
+void b_hold(uint8_t md, uint8_t (*cond)(void), const char *name)
+{
+    uint16_t reg[32];
+    uint64_t t0;
+
+    set_md = md;
+    s_timer = 50;
+    memcpy(reg, bk_chip, sizeof(reg));
+    b_start();
+    b_wake('U', cond);
+    b_row(name);
+    if(memcmp(reg, bk_chip, sizeof(reg)) != 0){
+        printf("%s: radio changed while held\n", name);
+    }
+    b_start();
+    adc_key = 'O';
+    t0 = sim_us;
+    while((memcmp(reg, bk_chip, sizeof(reg)) == 0) && (sim_us - t0 < 1000000)){
+        b_idle(1);
+    }
+    b_row("release to commit");
+}
+
+void bench_run(void)
+{
+    char name[32];
+    uint8_t bcd[3];
+
+    b_line("boot to audio", aud_txn, aud_byte, aud_bus, aud_us, aud_us, aud_cyc);
+    while((lcd_stg != 2) || lcd_req){
+        b_idle(1);
+    }
+    b_row("boot to lcd");
+
+    b_start();
+    rcv_set(6, 2, 10, 0x40);
+    b_row("rcv_set chan step");
+    b_start();
+    rcv_set(6, 2, 10, 0x40);
+    b_row("rcv_set unchanged");
+    b_start();
+    rcv_set(2, 2, 10, 0x40);
+    b_row("rcv_set band change");
+
+    frq_bcd(2, 2, bcd);
+    lcd_ch(0, bcd);
+    b_start();
+    snd_set(2, 2, 7);
+    lcd_ch(9, bcd);
+    b_row("ptt key-up");
+    b_start();
+    rcv_set(2, 2, 10, 0x40);
+    lcd_ch(0, bcd);
+    b_row("ptt key-down");
+
+    lcd_clr();
+    frq_bcd(6, 4, bcd);
+    b_start();
+    lcd_ch(0, bcd);
+    b_row("lcd_ch full");
+    frq_bcd(6, 6, bcd);
+    b_start();
+    lcd_ch(0, bcd);
+    b_row("lcd_ch step");
+
+    b_start();
+    for(uint8_t ch = 0; ch < 100; ch += 2){
+        rcv_set(6, ch, 10, 0x40);
+        frq_bcd(6, ch, bcd);
+        lcd_ch(3, bcd);
+    }
+    b_row("tuning sweep 50ch");
+
+    b_start();
+    bk_rssi();
+    b_row("bk_rssi read");
+
+    b_start();
+    frq_syn(0, 433020000, 3);
+    b_row("frq_syn word");
+    pll_chan(0, 6, 2);
+    b_start();
+    pll_chan(0, 6, 4);
+    b_row("pll_chan step");
+    b_start();
+    frq_bcd(6, 2, bcd);
+    b_row("frq_bcd rebuild");
+    b_start();
+    bcd_add(bcd, bcd_up2);
+    b_row("bcd_add step");
+    b_start();
+    sw_lvl(0x80);
+    b_row("sw_lvl lookup");
+
+    fr_band = 6;
+    fr_chan = 98;
+    frq_bcd(fr_band, fr_chan, fr_bcd);
+    b_idle(100);
+    b_start();
+    b_idle(1000);
+    snprintf(name, sizeof(name), "idle 1s %lu uA", (unsigned long)b_idd());
+    b_row(name);
+
+    b_idle(100);
+    b_start();
+    b_wake('P', b_tx);
+    b_row("wake ptt to tx");
+    b_start();
+    b_idle(1000);
+    b_row("ptt held 1s");
+    b_wake('O', b_rx);
+    b_idle(100);
+    b_start();
+    b_wake('R', b_menu);
+    b_row("wake right to menu");
+    adc_key = 'O';
+    b_idle(3000);
+
+    fr_band = 6;
+    fr_chan = 0;
+    frq_bcd(fr_band, fr_chan, fr_bcd);
+    b_idle(100);
+    b_hold(3, b_chan, "hold up 49ch");
+    sq_vol = 0;
+    b_idle(100);
+    b_hold(5, b_sql, "hold up squelch 63 steps");
+    sq_vol = 0x40;
+    b_idle(3000);
+
+    b_start();
+    cnt_tune = 0;
+    scn_hop();
+    while(sim_us - cnt_t0 < 1000000){
+        b_idle(1);
+    }
+    scn_st = 0;
+    snprintf(name, sizeof(name), "scan 1s %lu ch/s", (unsigned long)cnt_tune);
+    b_row(name);
+
+    sig_khz[sig_len] = 433500;
+    sig_lvl[sig_len++] = 0x50;
+    fr_chan = 0;
+    frq_bcd(fr_band, fr_chan, fr_bcd);
+    b_start();
+    scn_hop();
+    while(scn_st == 1){
+        b_idle(1);
+    }
+    scn_st = 0;
+    b_row("scan to carrier 25ch");
+
+    // the four memories on four bands, every hop switches band
+    for(uint8_t lp = 0; lp < 4; lp++){
+        fr_band = (uint8_t)(lp * 2);
+        fr_chan = (uint8_t)(lp * 10);
+        hef_pack(mem_ch[lp]);
+    }
+    b_start();
+    cnt_tune = 0;
+    scn_mem = 1;
+    scn_hop();
+    while(sim_us - cnt_t0 < 1000000){
+        b_idle(1);
+    }
+    scn_st = 0;
+    scn_mem = 0;
+    memset(mem_ch, 0xFF, 4 * 3);
+    snprintf(name, sizeof(name), "scan 1s mem %lu ch/s", (unsigned long)cnt_tune);
+    b_row(name);
+    fr_band = 6;
+    fr_chan = 0;
+    frq_bcd(fr_band, fr_chan, fr_bcd);
+
+    hef_save(0);
+    b_start();
+    hef_save(0);
+    b_row("hef save append");
+    while(hef_nxt < 8){
+        hef_save(0);
+    }
+    b_start();
+    hef_save(0);
+    b_row("hef save compact");
+    b_start();
+    hef_load();
+    b_row("hef restore");
+}
+
+void hef_end(void)
+{
+    FILE *fp;
+
+    if(hef_file == NULL){
+        return;
+    }
+    fp = fopen(hef_file, "wb");
+    if(fp != NULL){
+        fwrite(hef_mem, 1, HEF_LEN, fp);
+        fclose(fp);
+    }
+}
+
+void sim_idle(void)
+{
+    if(bench){
+        bench_run();
+        exit(0);
+    }
+    if(!sim_due()){
+        sim_spin();
+    }
+    sim_log();
+    if(sim_us >= scr_end * 1000ULL){
+        hef_end();
+        exit(0);
+    }
+}
+
+// HEF flash model, programming only clears bits
+uint8_t hef_rd(uint16_t adr)
+{
+    return hef_mem[(adr - HEF_ADR) % HEF_LEN];
+}
+
+void hef_erase(uint16_t adr)
+{
+    memset(&hef_mem[((adr - HEF_ADR) % HEF_LEN) & ~(HEF_ROW - 1)], 0xFF, HEF_ROW);
+    sim_wait(HEF_TPEW);
+}
+
+void hef_wr(uint16_t adr, const uint8_t *dat, uint8_t len)
+{
+    for(uint8_t lp = 0; lp < len; lp++){
+        hef_mem[(adr + lp - HEF_ADR) % HEF_LEN] &= dat[lp];
+    }
+    sim_wait(HEF_TPEW);
+}
+
+// BK4802 and ST7032 bus models
+void i2c_init(void)
+{
+}
+
+void i2c_start(void)
+{
+    cnt_txn++;
+    cnt_bus += BUS_START;
+    sim_wait(BUS_START);
+    bus_cnt = 0;
+}
+
+void i2c_rstart(void)
+{
+    cnt_bus += BUS_START;
+    sim_wait(BUS_START);
+    bus_cnt = 0;
+}
+
+void lcd_exec(uint8_t cmd)
+{
+    if(cmd == 0x01){
+        memset(lcd_ram, ' ', sizeof(lcd_ram));
+        lcd_ac = 0;
+    } else if((cmd & 0xFE) == 0x02){
+        lcd_ac = 0;
+    } else if(cmd & 0x80){
+        lcd_ac = cmd & 0x7F;
+    }
+}
+
+void i2c_snd(uint8_t data)
+{
+    cnt_byte++;
+    cnt_bus += BUS_BYTE;
+    sim_wait(BUS_BYTE);
+    if(bus_cnt == 0){
+        bus_dev = data & 0xFE;
+        bus_rd = data & 0x01;
+    } else if(bus_dev == I2C_ADR){
+        if(bus_cnt == 1){
+            bk_ptr = data & 0x1F;
+        } else if(bus_cnt == 2){
+            bus_hi = data;
+        } else if(bus_cnt == 3){
+            bk_chip[bk_ptr] = (uint16_t)((bus_hi << 8) | data);
+            if(bk_ptr == 1){
+                cnt_tune++;
+            }
+            if((bk_ptr == 0) && (aud_us == 0) && !(bk_chip[4] & 0x7C00)){
+                aud_us = sim_us;
+                aud_txn = cnt_txn;
+                aud_byte = cnt_byte;
+                aud_bus = cnt_bus;
+                aud_cyc = sim_cyc;
+            }
+        }
+    } else if(bus_dev == I2C_LCD){
+        if(bus_cnt == 1){
+            lcd_ctl = data;
+        } else if(lcd_ctl & 0x40){
+            lcd_ram[lcd_ac % sizeof(lcd_ram)] = data;
+            lcd_ac++;
+        } else {
+            lcd_exec(data);
+        }
+    }
+    bus_cnt++;
+}
+
+uint8_t i2c_ack(void)
+{
+    return (bus_dev == I2C_ADR) || (bus_dev == I2C_LCD);
+}
+
+uint8_t i2c_rcv(uint8_t ack)
+{
+    uint16_t dat;
+
+    cnt_byte++;
+    cnt_bus += BUS_BYTE;
+    sim_wait(BUS_BYTE);
+    dat = ((bus_dev == I2C_ADR) && bus_rd) ? bk_read(bk_ptr) : 0xFFFF;
+    return (uint8_t)((bus_cnt++ == 1) ? (dat >> 8) : dat);
+}
+
+void i2c_stop(void)
+{
+    cnt_bus += BUS_STOP;
+    sim_wait(BUS_STOP);
+}
+
+void scr_load(FILE *fp)
+{
+    char line[80];
+    char key[8];
+    unsigned long ms;
+    unsigned long lvl;
+
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if((sscanf(line, "sig %lu %lu", &ms, &lvl) == 2) && (sig_len < SIG_MAX)){
+            sig_khz[sig_len] = (uint32_t)ms;
+            sig_lvl[sig_len] = (uint8_t)(lvl & 0x7F);
+            sig_len++;
+            continue;
+        }
+        if(sscanf(line, "end %lu", &ms) == 1){
+            scr_end = (uint32_t)ms;
+            continue;
+        }
+        if(strncmp(line, "lad", 3) == 0){
+            sscanf(line, "lad %hhx %hhx %hhx %hhx %hhx %hhx %hhx", &lad_lvl[0], &lad_lvl[1],
+                &lad_lvl[2], &lad_lvl[3], &lad_lvl[4], &lad_lvl[5], &lad_lvl[6]);
+            continue;
+        }
+        if((line[0] == '#') || (sscanf(line, "%lu %7s", &ms, key) != 2)){
+            continue;
+        }
+        if(strcmp(key, "end") == 0){
+            scr_end = (uint32_t)ms;
+        } else if(scr_len < SCR_MAX){
+            scr_ms[scr_len] = (uint32_t)ms;
+            scr_key[scr_len] = (uint8_t)key[0];
+            scr_len++;
+        }
+    }
+    if((scr_end == 0) && (scr_len != 0)){
+        scr_end = scr_ms[scr_len - 1] + 1000;
+    }
+    if(scr_end == 0){
+        scr_end = 2000;
+    }
+}
+
+// --selftest, PLL words against the hand-computed ones in fm-trcv.c
+//  (the frequency comment table and the old frq_cal() base constants)
+typedef struct {
+    uint32_t khz;
+    uint8_t div;        // pll_mul[] index
+    uint32_t rx;
+    uint32_t tx;
+} st_word;
+
+const st_word st_tbl[] = {
+    { 29000, 0, 0x56EDB66A, 0x57575757},
+    { 29020, 0, 0x56FD21FF, 0x5766C2EB},
+    { 29640, 0, 0x58DB28FB, 0x5944C9E8},
+    { 51000, 1, 0x562AFBE1, 0x56666666},
+    {144000, 2, 0x513D8324, 0x51515151},
+    {144020, 2, 0x51406750, 0x5154357D},
+    {144640, 2, 0x519A08A0, 0x51ADD6CC},
+    {145000, 2, 0x51CE13B5, 0x51E1E1E1},
+    {145020, 2, 0x51D0F7E1, 0x51E4C60D},
+    {145640, 2, 0x522A9930, 0x523E675D},
+    {431000, 3, 0x511A8712, 0x51212121},
+    {431020, 3, 0x511B7DCB, 0x512217DA},
+    {431640, 3, 0x51395E3B, 0x513FF84A},
+    {432000, 3, 0x514AB742, 0x51515151},
+    {432020, 3, 0x514BADFB, 0x5152480A},
+    {432640, 3, 0x51698E6B, 0x5170287A},
+    {433000, 3, 0x517AE772, 0x51818181},
+    {433020, 3, 0x517BDE2B, 0x5182783A},
+    {433640, 3, 0x5199BE9B, 0x51A058AA},
+    {438000, 3, 0x526BD863, 0x52727272}
+};
+
+uint32_t st_cnt;
+uint32_t st_fail;
+
+void st_chk(const char *what, uint32_t khz, uint32_t got, uint32_t want)
+{
+    st_cnt++;
+    if(got != want){
+        st_fail++;
+        printf("FAIL %s %lu kHz %08lX want %08lX\n", what, (unsigned long)khz,
+            (unsigned long)got, (unsigned long)want);
+    }
+}
+
+// pll_chan() on one channel against a fresh frq_syn()
+void st_pll(uint8_t tr_mode, uint8_t band, uint8_t chan)
+{
+    uint32_t f_hz = frq_hz(band, chan);
+
+    st_chk(tr_mode ? "pll_chan tx" : "pll_chan rx", f_hz / 1000,
+        pll_chan(tr_mode, band, chan), frq_syn(tr_mode, f_hz, band_div[band]));
+}
+
+// Every band, RX and TX: 20kHz steps up to the top and back down,
+//  then random moves of 2 and 10 channels as chg_frq/chg_frh make them
+void st_walk(void)
+{
+    int chan;
+
+    srand(1);
+    for(uint8_t tr = 0; tr < 2; tr++){
+        for(uint8_t band = 0; band < BAND_CNT; band++){
+            for(chan = 0; chan < band_chs[band]; chan += 2){
+                st_pll(tr, band, chan);
+            }
+            for(chan -= 2; chan >= 0; chan -= 2){
+                st_pll(tr, band, chan);
+            }
+            chan = 0;
+            for(uint16_t lp = 0; lp < 1000; lp++){
+                chan += ((rand() & 1) ? 2 : 10) * ((rand() & 2) ? 1 : -1);
+                if(chan < 0){
+                    chan += band_chs[band];
+                }
+                if(chan >= band_chs[band]){
+                    chan -= band_chs[band];
+                }
+                st_pll(tr, band, chan);
+            }
+        }
+    }
+}
+
+int st_run(void)
+{
+    for(uint8_t lp = 0; lp < sizeof(st_tbl) / sizeof(st_tbl[0]); lp++){
+        st_chk("frq_syn rx", st_tbl[lp].khz, frq_syn(0, st_tbl[lp].khz * 1000, st_tbl[lp].div),
+            st_tbl[lp].rx);
+        st_chk("frq_syn tx", st_tbl[lp].khz, frq_syn(1, st_tbl[lp].khz * 1000, st_tbl[lp].div),
+            st_tbl[lp].tx);
+    }
+    st_walk();
+    printf("selftest %lu checks, %lu failed\n", (unsigned long)st_cnt, (unsigned long)st_fail);
+    return st_fail != 0;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+
+    if((argc > 1) && (strcmp(argv[1], "--selftest") == 0)){
+        return st_run();
+    }
+    if((argc > 1) && (strcmp(argv[1], "--bench") == 0)){
+        bench = 1;
+        printf("scenario,txn,bytes,bits,bus_us,elapsed_us,blocked_tcy,cpu_tcy\n");
+    } else if(argc > 1){
+        fp = fopen(argv[1], "r");
+        if(fp == NULL){
+            perror(argv[1]);
+            return 1;
+        }
+        scr_load(fp);
+        fclose(fp);
+    } else {
+        scr_load(stdin);
+    }
+
+    memset(hef_mem, 0xFF, sizeof(hef_mem));
+    if((argc > 2) && !bench){
+        hef_file = argv[2];
+        fp = fopen(hef_file, "rb");
+        if(fp != NULL){
+            if(fread(hef_mem, 1, HEF_LEN, fp) != HEF_LEN){
+                memset(hef_mem, 0xFF, sizeof(hef_mem));
+            }
+            fclose(fp);
+        }
+    }
+    memset(lcd_ram, ' ', sizeof(lcd_ram));
+    while((scr_pos < scr_len) && (scr_ms[scr_pos] == 0)){
+        adc_key = scr_key[scr_pos++];     // held at power-on
+    }
+    sim_tick = 1000;
+    fw_main();
+    return 0;
+}
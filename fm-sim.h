@@ -0,0 +1,142 @@
+/*
+ * Host simulator for fm-trcv.c
+ *
+ *  Stands in for <xc.h> when fm-trcv.c is built with -DSIM_HOST.
+ *  SFRs are plain variables, delays advance a simulated clock, and the
+ *  I2C byte layer, ADC, HEF flash, SLEEP and idle hook are served by
+ *  fm-sim.c.
+ *
+ *      cc -DSIM_HOST -o fm-sim fm-trcv.c fm-sim.c
+ *
+ *  (C)2021 JK1MLY All rights reserved.
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+*/
+
+#ifndef FM_SIM_H
+#define FM_SIM_H
+
+#include <stdint.h>
+
+#define I2C_HW      0
+#ifndef CLK_MHZ
+#define CLK_MHZ     4       // same default as fm-trcv.c
+#endif
+
+typedef union {
+    uint8_t r;
+    struct {
+        unsigned b0:1;
+        unsigned b1:1;
+        unsigned b2:1;
+        unsigned b3:1;
+        unsigned b4:1;
+        unsigned b5:1;
+        unsigned b6:1;
+        unsigned b7:1;
+    };
+} sim_sfr;
+
+extern volatile sim_sfr sim_lata;
+extern volatile sim_sfr sim_trisa;
+extern volatile sim_sfr sim_porta;
+extern volatile sim_sfr sim_latc;
+extern volatile sim_sfr sim_intcon;
+extern volatile sim_sfr sim_pie1;
+extern volatile sim_sfr sim_pir1;
+extern volatile sim_sfr sim_status;
+extern volatile uint8_t sim_reg[16];
+
+// byte registers
+#define LATA        sim_lata.r
+#define TRISA       sim_trisa.r
+#define LATC        sim_latc.r
+#define INTCON      sim_intcon.r
+#define TRISC       sim_reg[0]
+#define OSCCON      sim_reg[1]
+#define OPTION_REG  sim_reg[2]
+#define WPUA        sim_reg[3]
+#define ANSELA      sim_reg[4]
+#define ADCON0      sim_reg[5]
+#define ADCON1      sim_reg[6]
+#define ADCON2      sim_reg[7]
+#define ADRESH      sim_reg[8]
+#define ADRESL      sim_reg[9]
+#define TMR0        sim_reg[10]
+#define T1CON       sim_reg[11]
+#define WDTCON      sim_reg[12]
+#define IOCAN       sim_reg[13]
+#define IOCAF       sim_reg[14]
+#define TMR1L       ((uint8_t)sim_tcy())
+#define TMR1H       ((uint8_t)(sim_tcy() >> 8))
+
+// bits
+#define LATA0       sim_lata.b0
+#define LATA1       sim_lata.b1
+#define LATA5       sim_lata.b5
+#define TRISA0      sim_trisa.b0
+#define TRISA1      sim_trisa.b1
+#define RA2         sim_porta.b2
+#define RA4         sim_porta.b4
+#define LATC0       sim_latc.b0
+#define LATC1       sim_latc.b1
+#define LATC2       sim_latc.b2
+#define LATC3       sim_latc.b3
+#define LATC4       sim_latc.b4
+#define LATC5       sim_latc.b5
+#define GIE         sim_intcon.b7
+#define PEIE        sim_intcon.b6
+#define TMR0IE      sim_intcon.b5
+#define IOCIE       sim_intcon.b3
+#define TMR0IF      sim_intcon.b2
+#define ADIE        sim_pie1.b6
+#define ADIF        sim_pir1.b6
+#define nTO         sim_status.b4
+
+// compiler intrinsics
+#define __delay_us(x)   sim_wait((uint32_t)(x))
+#define __delay_ms(x)   sim_wait((uint32_t)(x) * 1000)
+#define __interrupt(...)
+#define NOP()
+#define SLEEP()     sim_sleep()
+#ifndef SIM_MODEL
+#define main        fw_main
+#endif
+
+// HAL
+#define ADC_START() sim_adc_start()
+#define ADC_BUSY()  sim_adc_busy()
+#define HAL_IDLE()  sim_idle()
+#define HAL_SPIN()  sim_spin()
+#define CYC(n)      (sim_cyc += (n))
+
+extern uint64_t sim_cyc;
+
+uint16_t sim_tcy(void);
+void sim_wait(uint32_t us);
+void sim_adc_start(void);
+uint8_t sim_adc_busy(void);
+void sim_idle(void);
+void sim_spin(void);
+void sim_sleep(void);
+uint8_t hef_rd(uint16_t adr);
+void hef_erase(uint16_t adr);
+void hef_wr(uint16_t adr, const uint8_t *dat, uint8_t len);
+
+// firmware entry points
+void isr(void);
+void fw_main(void);
+void i2c_init(void);
+void i2c_start(void);
+void i2c_rstart(void);
+void i2c_snd(uint8_t data);
+uint8_t i2c_ack(void);
+uint8_t i2c_rcv(uint8_t ack);
+void i2c_stop(void);
+
+#endif
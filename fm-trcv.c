@@ -16,13 +16,48 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#ifdef SIM_HOST
+#include "fm-sim.h"
+#else
 #include <xc.h>
 #include <pic.h>
+#endif
+
+// Clock profile
+//  CLK_MHZ is the only clock setting, the delay loops, MSSP baud rate,
+//  ADC conversion clock and the 1ms tick are all derived from it.
+#ifndef CLK_MHZ
+#define CLK_MHZ     4       // 4 8 16, 32 with 4x PLL on PIC16F1705
+#endif
+#if CLK_MHZ == 32
+#if !defined(_16F1705)
+#error "32MHz needs the 4x PLL, PIC16F1705 only"
+#endif
+#define OSC_SET     0b11110000  // SPLLEN 8MHz x4
+#define ADC_CS      0b010       // Fosc/32 TAD 1us
+#define TMR0_PS     0b100       // 1:32
+#elif CLK_MHZ == 16
+#define OSC_SET     0b01111000  // 16MHz
+#define ADC_CS      0b101       // Fosc/16 TAD 1us
+#define TMR0_PS     0b011       // 1:16
+#elif CLK_MHZ == 8
+#define OSC_SET     0b01110000  // 8MHz
+#define ADC_CS      0b001       // Fosc/8 TAD 1us
+#define TMR0_PS     0b010       // 1:8
+#elif CLK_MHZ == 4
+#define OSC_SET     0b01101000  // 4MHz
+#define ADC_CS      0b100       // Fosc/4 TAD 1us
+#define TMR0_PS     0b001       // 1:4
+#else
+#error "CLK_MHZ must be 4, 8, 16 or 32"
+#endif
+#define _XTAL_FREQ  ((uint32_t)CLK_MHZ * 1000000)
+#define TMR0_RLD    6           // Fosc/4/PS = 250kHz, 250 counts 1ms
+#define ADC_ACQ     20          // us, acquisition before GO
 
-#define _XTAL_FREQ 8000000
 // CONFIG1
 #pragma config FOSC = INTOSC    // Oscillator Selection
-#pragma config WDTE = OFF       // Watchdog Timer
+#pragma config WDTE = SWDTEN    // Watchdog Timer, on in pwr_idle() only
 #pragma config PWRTE = OFF      // Power-up Timer
 #pragma config MCLRE = OFF      // MCLR Pin Function Select
 #pragma config CP = OFF         // Flash Program Memory Code Protection
@@ -30,7 +65,9 @@
 #pragma config CLKOUTEN = OFF   // Clock Out Enable
 // CONFIG2
 #pragma config WRT = OFF        // Flash Memory Self-Write Protection
-// #pragma config PLLEN = OFF      // 4x PLL OFF
+#if defined(_16F1705)
+#pragma config PLLEN = OFF      // 4x PLL by SPLLEN
+#endif
 #pragma config STVREN = OFF     // Stack Overflow/Underflow Reset Enable
 #pragma config BORV = LO        // Brown-out Reset Voltage Selection
 // #pragma config LPBOREN = OFF    // Low Power Brown-out Reset Enable
@@ -39,11 +76,44 @@
 #define false       0
 #define true        1
 
+// HAL
+//  GPIO goes through the LATx/TRISx macros below, delays through
+//  __delay_us/__delay_ms, the I2C byte layer is i2c_start/i2c_snd/
+//  i2c_stop, loops waiting on an interrupt call HAL_SPIN(). fm-sim.h
+//  supplies host versions of all of them.
+//  CYC(n) charges n instruction cycles, counted by hand from the
+//  enhanced mid-range instruction set, to the host bench. The hot
+//  routines carry one per call or per loop pass, the target build
+//  drops them.
+#ifndef SIM_HOST
+#define ADC_START() GO_nDONE = 1
+#define ADC_BUSY()  GO_nDONE
+#define HAL_IDLE()
+#define HAL_SPIN()
+#define CYC(n)
+#endif
+
 #define SDA_LOW     LATA0 = 0;TRISA0 = 0    // 0
 #define SDA_HIGH    LATA0 = 1;TRISA0 = 1    // Z(1))
 #define SCK_LOW     LATA1 = 0
 #define SCK_HIGH    LATA1 = 1
 
+#ifndef I2C_HW
+#define I2C_HW      0       // 0:bit-bang RA0/RA1  1:MSSP
+#endif
+#ifndef I2C_KHZ
+#define I2C_KHZ     100     // MSSP SCL 100 or 400
+#endif
+#if I2C_HW
+#if !defined(_16F1705)
+#error "MSSP on RA0/RA1 needs PPS, PIC16F1705 only"
+#endif
+#define I2C_BRG     ((CLK_MHZ * 1000 / 4 / I2C_KHZ) - 1)
+#if I2C_BRG < 3
+#error "I2C_KHZ too fast for CLK_MHZ"
+#endif
+#endif
+
 #define I2C_ADR     0x90
 #define I2C_LCD     0x7c
 
@@ -59,21 +129,29 @@
 #define S_VOL       2
 #define S_SQL       3
 
-#define BSW28       LATC1=1;LATC2=0;LATC3=0;LATC4=0;LATC5=0
-#define BSW50       LATC1=0;LATC2=1;LATC3=0;LATC4=0;LATC5=0
-#define BSW144      LATC1=0;LATC2=0;LATC3=1;LATC4=0;LATC5=0
-//#define BSW144    LATC1=0;LATC2=1;LATC3=0;LATC4=0;LATC5=0
-//#define BSW50     LATC1=0;LATC2=0;LATC3=1;LATC4=0;LATC5=0
-//#define BSW430    LATC1=0;LATC2=0;LATC3=0;LATC4=1;LATC5=0
-//#define BSWTUN    LATC1=0;LATC2=0;LATC3=0;LATC4=0;LATC5=1
-#define BSW430      LATC1=0;LATC2=0;LATC3=0;LATC4=0;LATC5=1
-#define BSWTUN      LATC1=0;LATC2=0;LATC3=0;LATC4=1;LATC5=0
-#define BSWOFF      LATC1=0;LATC2=0;LATC3=0;LATC4=0;LATC5=0
-#define RFAON       LATC0=1
-#define RFAOFF      LATC0=0
+// band filter, LATC5:1
+#define BSW28       0b00000010
+#define BSW50       0b00000100
+#define BSW144      0b00001000
+//#define BSW144    0b00000100
+//#define BSW50     0b00001000
+//#define BSW430    0b00010000
+//#define BSWTUN    0b00100000
+#define BSW430      0b00100000
+#define BSWTUN      0b00010000
+#define BSWOFF      0b00000000
+#define BSW_MSK     0b00111110
+#define RFA         0b00000001  // LATC0 RF amp
+#define RF_MSK      (BSW_MSK | RFA)
+#ifndef RF_BBM
+#define RF_BBM      0           // us all open before TX, 0:direct
+#endif
+#define BK_REGS     24
 #define REG_VOL     19
 #define REG_SQL     22  //RSSI
 //#define REG_SQL     23  //NOISE
+#define REG_RSSI    24  // read only, RSSI[6:0]
+#define REG_NOISE   25  // read only, noise[6:0]
 
 #define FRQ_REG     frq_reg28a
 
@@ -116,10 +194,13 @@
 
 void port_init(void) {
     /* CONFIGURE GPIO */
-    OSCCON  = 0b01101000;    //4MHz
+    OSCCON  = OSC_SET;
+#if CLK_MHZ == 32
+    while(PLLR == 0) ;
+#endif
 //  TRISA   = 0b00011101;    //Input(1)     // B4 refine
     TRISA   = 0b00011101;    //Input(1)
-    OPTION_REG = 0b00000000; //MSB WPUENn
+    OPTION_REG = TMR0_PS;    //MSB WPUENn TMR0CS PSA PS2:0
     WPUA    = 0b00011001;    //PupOn(1)
     INTCON  = 0b00000000;
     LATA    = 0b00000011;
@@ -127,18 +208,200 @@ void port_init(void) {
     ANSELA  = 0b00000100;    //ANSA RA2;AN2=DET
 //  ADCON0  = 0b00001101;    //0 CHS4:0 GO ON AN3   // B4 refine
     ADCON0  = 0b00001001;    //0 CHS4:0 GO ON AN2
-    ADCON1  = 0b10000000;    //ADFM ADCS2:0 00 ADPREF1:0
-                //ADCS 000=F/2 100=F/4 001=F/8 101=F/101
+    ADCON1  = 0b10000000 | (ADC_CS << 4);    //ADFM ADCS2:0 00 ADPREF1:0
+                //ADCS 000=F/2 100=F/4 001=F/8 101=F/16 010=F/32
     ADCON2  = 0b00000000;
     TRISC   = 0b00000000;
     LATC    = 0b00000000;
+}
 
-    for(uint8_t i = 0; i < 3; i++){
-        LED_ON;
-        __delay_ms(100);
-        LED_OFF;
-        __delay_ms(100);
+// Timer1, free running at Fosc/4
+uint16_t tmr1_get(void)
+{
+    uint8_t th;
+    uint8_t tl;
+
+    do {
+        th = TMR1H;
+        tl = TMR1L;
+    } while(th != TMR1H);
+    return (uint16_t)(((uint16_t)th << 8) | tl);
+}
+
+// Trace points
+//  TRC(id) logs a Timer1 timestamp and an event id in trc_buf[], exits
+//  are logged as id | TRC_END. With TRACE 0 they compile to nothing.
+//  Key presses are logged as they are queued, releases with TRC_END. A
+//  scheduler task run that took less than TRC_NOP cycles and logged
+//  nothing inside is taken out again, so idle polls do not wrap the ring.
+//  TRC_AFT entries after the first TRC_TRG (PTT) the ring freezes, the
+//  key press before it and the retune stay until the dump.
+//  The CT key dumps the buffer, on EUSART TX (RA5, shared with the LED)
+//  on PIC16F1705, otherwise on the LCD, one entry every 300ms, and
+//  rearms the trigger.
+#ifndef TRACE
+#define TRACE       0
+#endif
+
+#define TRC_RCV     0x01    // rcv_set
+#define TRC_SND     0x02    // snd_set
+#define TRC_LCD     0x03    // lcd_out
+#define TRC_KEY     0x08    // + key, press queued
+#define TRC_TSK     0x10    // + scheduler task number
+#define TRC_END     0x80
+
+#if TRACE
+#define TRC_LEN     32      // power of 2
+#define TRC_NOP     50      // cycles
+#define TRC_TRG     TRC_SND
+#define TRC_AFT     16      // entries
+#define TRC_BAUD    9600
+#define TRC(id)     trc_log(id)
+#define TRC_RUN(id, t)  trc_run(id, t)
+
+typedef struct {
+    uint16_t t;
+    uint8_t id;
+} trc_ent;
+
+trc_ent trc_buf[TRC_LEN];
+uint8_t trc_pos;
+uint8_t trc_on = true;
+uint8_t trc_aft;
+
+void trc_log(uint8_t id)
+{
+    uint8_t gie;
+
+    if(trc_on == false){
+        return;
+    }
+    gie = GIE;
+    GIE = 0;
+    if((trc_aft == 1) && ((id & TRC_END) == 0)){
+        trc_on = false;
+    } else {
+        trc_buf[trc_pos].t = tmr1_get();
+        trc_buf[trc_pos].id = id;
+        trc_pos = (trc_pos + 1) & (TRC_LEN - 1);
+        if(id == TRC_TRG){
+            trc_aft = TRC_AFT + 1;
+        } else if(trc_aft > 1){
+            trc_aft--;
+        }
     }
+    GIE = gie;
+}
+
+// task exit, drops the entry instead when it is the last one and the
+// run was shorter than TRC_NOP
+void trc_run(uint8_t id, uint16_t t_run)
+{
+    uint8_t gie;
+    uint8_t lst;
+
+    gie = GIE;
+    GIE = 0;
+    lst = (trc_pos - 1) & (TRC_LEN - 1);
+    if(trc_on && (t_run < TRC_NOP) && (trc_buf[lst].id == (uint8_t)(id & ~TRC_END))){
+        trc_buf[lst].id = 0;
+        trc_pos = lst;
+        if(trc_aft > 1){
+            trc_aft++;
+        }
+    } else {
+        trc_log(id);
+    }
+    GIE = gie;
+}
+#else
+#define TRC(id)
+#define TRC_RUN(id, t)
+#endif
+
+
+#if I2C_HW
+// MSSP master on RA0/RA1 through PPS
+//  i2c_snd() only loads SSP1BUF, the next call waits for the shift to end
+void i2c_init(void)
+{
+    TRISA0 = 1;
+    TRISA1 = 1;
+    RA0PPS = 0x11;          // SDA
+    RA1PPS = 0x10;          // SCL
+    SSPDATPPS = 0x00;       // RA0
+    SSPCLKPPS = 0x01;       // RA1
+    SSP1ADD = I2C_BRG;
+#if I2C_KHZ > 100
+    SSP1STAT = 0b00000000;  // slew rate control on
+#else
+    SSP1STAT = 0b10000000;  // slew rate control off
+#endif
+    SSP1CON2 = 0b00000000;
+    SSP1CON1 = 0b00101000;  // SSPEN I2C master
+    SSP1IF = 0;
+    SSP1IE = 1;
+    PEIE = 1;
+    GIE = 1;
+}
+
+void i2c_idle(void)
+{
+    while((SSP1CON2 & 0x1F) || SSP1STATbits.R_nW) ;
+}
+
+void i2c_snd(uint8_t data)
+{
+    i2c_idle();
+    SSP1BUF = data;
+}
+
+uint8_t i2c_ack(void)
+{
+    i2c_idle();
+    return !SSP1CON2bits.ACKSTAT;
+}
+
+uint8_t i2c_rcv(uint8_t ack)
+{
+    uint8_t data;
+
+    i2c_idle();
+    SSP1CON2bits.RCEN = 1;
+    while(!SSP1STATbits.BF) ;
+    data = SSP1BUF;
+    SSP1CON2bits.ACKDT = ack ? 0 : 1;
+    SSP1CON2bits.ACKEN = 1;
+    return data;
+}
+
+void i2c_start(void)
+{
+    i2c_idle();
+    SSP1CON2bits.SEN = 1;
+}
+
+void i2c_rstart(void)
+{
+    i2c_idle();
+    SSP1CON2bits.RSEN = 1;
+}
+
+void i2c_stop(void)
+{
+    i2c_idle();
+    SSP1CON2bits.PEN = 1;
+}
+
+#elif defined(SIM_HOST)
+// bus models in fm-sim.c
+#else
+uint8_t i2c_nak;            // ACK slot of the last byte, 1:NAK
+
+void i2c_init(void)
+{
+    SDA_HIGH;
+    SCK_HIGH;
 }
 
 void i2c_snd(uint8_t data)
@@ -163,12 +426,407 @@ void i2c_snd(uint8_t data)
     __delay_us(8);
     SCK_HIGH;
     __delay_us(4);
+    i2c_nak = RA0;
     SCK_LOW;
 //    __delay_us(2);
     SDA_LOW;
     __delay_us(20);
 }
 
+uint8_t i2c_ack(void)
+{
+    return !i2c_nak;
+}
+
+uint8_t i2c_rcv(uint8_t ack)
+{
+    uint8_t data = 0;
+
+    SDA_HIGH;
+    for(uint8_t i = 0; i < 8; i++){
+        __delay_us(2);
+        SCK_HIGH;
+        __delay_us(2);
+        data = (uint8_t)((data << 1) | RA0);
+        __delay_us(2);
+        SCK_LOW;
+        __delay_us(2);
+    }
+
+// ACK/NAK
+    if(ack){
+        SDA_LOW;
+    }
+    __delay_us(2);
+    SCK_HIGH;
+    __delay_us(4);
+    SCK_LOW;
+    SDA_LOW;
+    __delay_us(2);
+    return data;
+}
+
+void i2c_start(void)
+{
+    SDA_HIGH;
+    __delay_us(2);
+    SCK_HIGH;
+    __delay_us(2);
+    SDA_LOW;
+    __delay_us(2);
+    SCK_LOW;
+    __delay_us(2);
+}
+
+// SDA is released by the ACK slot, so a repeated START is a plain START
+void i2c_rstart(void)
+{
+    i2c_start();
+}
+
+void i2c_stop(void)
+{
+    SCK_HIGH;
+    __delay_us(6);
+    SDA_HIGH;
+// Wait
+    __delay_us(20);
+}
+#endif
+
+// BK4802 shadow registers
+//  bk_reg[] mirrors what the chip holds, bk_dirty[] has one bit per register
+//  that still has to go out on the bus. REG3 is never written.
+uint16_t bk_reg[BK_REGS];
+uint8_t bk_dirty[3] = {0xF7, 0xFF, 0xFF};
+
+void bk_wr(uint8_t adr, uint16_t dat)
+{
+    CYC(16);
+    if(bk_reg[adr] != dat){
+        bk_reg[adr] = dat;
+        bk_dirty[adr >> 3] |= (uint8_t)(1 << (adr & 7));
+    }
+}
+
+// I2C transaction queue
+//  i2c_q[] is drained in order, i2c_p[] (PTT critical) jumps ahead of it.
+//  BK4802 entries carry only the register number, the data is taken from
+//  bk_reg[] when the transaction starts, so a late entry never sends a
+//  stale value. With I2C_HW the MSSP interrupt runs i2c_step(). The
+//  bit-banged build sends one transaction per Timer0 tick from the
+//  interrupt (i2c_one), priority entries and everything before
+//  key_init() go out at once. i2c_pdone is true once the last priority
+//  entry has had its STOP.
+#define I2C_QLEN    8       // power of 2
+#define I2C_PLEN    8
+
+#define I2C_IDLE    0
+#define I2C_DEV     1
+#define I2C_REG     2
+#define I2C_DHI     3
+#define I2C_DLO     4
+#define I2C_END     5
+#define I2C_NXT     6
+
+typedef struct {
+    uint8_t dev;        // slave address
+    uint8_t reg;        // BK4802 register or ST7032 control byte
+    uint8_t dat;        // ST7032 data byte, byte count with ptr
+    const uint8_t *ptr; // ST7032 burst data, NULL for one byte
+} i2c_txn;
+
+i2c_txn i2c_q[I2C_QLEN];
+i2c_txn i2c_p[I2C_PLEN];
+i2c_txn i2c_cur;
+volatile uint8_t i2c_qh, i2c_qt;
+volatile uint8_t i2c_ph, i2c_pt;
+volatile uint8_t i2c_st = I2C_IDLE;
+volatile uint8_t i2c_pdone = true;  // priority entries all sent
+uint8_t i2c_cpri;                   // i2c_cur from i2c_p[]
+#if !I2C_HW
+volatile uint8_t i2c_lck;           // main is on the bus, keep the tick off
+#endif
+
+void i2c_step(void)
+{
+    CYC(24);
+    switch (i2c_st){
+        case I2C_DEV:
+            i2c_snd((uint8_t)(i2c_cur.dev & 0xFE));
+            i2c_st = I2C_REG;
+            break;
+        case I2C_REG:
+            i2c_snd(i2c_cur.reg);
+            if(i2c_cur.dev == I2C_ADR){
+                i2c_st = I2C_DHI;
+            } else {
+                i2c_st = I2C_DLO;
+            }
+            break;
+        case I2C_DHI:
+            i2c_snd((uint8_t)((bk_reg[i2c_cur.reg] >> 8) & 0xFF));
+            i2c_st = I2C_DLO;
+            break;
+        case I2C_DLO:
+            if(i2c_cur.dev == I2C_ADR){
+                i2c_snd((uint8_t)(bk_reg[i2c_cur.reg] & 0xFF));
+            } else if(i2c_cur.ptr){
+                i2c_snd(*i2c_cur.ptr++);
+                if(--i2c_cur.dat != 0){
+                    break;
+                }
+            } else {
+                i2c_snd(i2c_cur.dat);
+            }
+            i2c_st = I2C_END;
+            break;
+        case I2C_END:
+            i2c_stop();
+            if(i2c_cpri && (i2c_ph == i2c_pt)){
+                i2c_pdone = true;
+            }
+            i2c_st = I2C_NXT;
+            break;
+        default:
+            if(i2c_ph != i2c_pt){
+                i2c_cur = i2c_p[i2c_ph];
+                i2c_ph = (i2c_ph + 1) & (I2C_PLEN - 1);
+                i2c_cpri = true;
+            } else if(i2c_qh != i2c_qt){
+                i2c_cur = i2c_q[i2c_qh];
+                i2c_qh = (i2c_qh + 1) & (I2C_QLEN - 1);
+                i2c_cpri = false;
+            } else {
+                i2c_st = I2C_IDLE;
+                break;
+            }
+            i2c_st = I2C_DEV;
+            i2c_start();
+    }
+}
+
+#if !I2C_HW
+// one whole transaction, IDLE once both queues are empty
+void i2c_one(void)
+{
+    do {
+        i2c_step();
+    } while((i2c_st != I2C_NXT) && (i2c_st != I2C_IDLE));
+    if((i2c_ph == i2c_pt) && (i2c_qh == i2c_qt)){
+        i2c_st = I2C_IDLE;
+    }
+}
+#endif
+
+void i2c_kick(uint8_t pri)
+{
+#if I2C_HW
+    SSP1IE = 0;
+    if(i2c_st == I2C_IDLE){
+        i2c_step();
+    }
+    SSP1IE = 1;
+#else
+    if(pri || (TMR0IE == 0)){
+        i2c_lck = true;
+        if(i2c_st == I2C_IDLE){
+            i2c_st = I2C_NXT;
+        }
+        do {
+            i2c_one();
+        } while((i2c_st != I2C_IDLE) && (!pri || !i2c_pdone));
+        i2c_lck = false;
+    } else if(i2c_st == I2C_IDLE){
+        i2c_st = I2C_NXT;       // the next tick starts it
+    }
+#endif
+}
+
+void i2c_put(uint8_t pri, uint8_t dev, uint8_t reg, uint8_t dat, const uint8_t *ptr)
+{
+    uint8_t nxt;
+    uint8_t gie;
+
+    CYC(40);
+    if(pri){
+        nxt = (i2c_pt + 1) & (I2C_PLEN - 1);
+        while(nxt == i2c_ph){       // full, MSSP frees a slot
+            HAL_SPIN();
+        }
+        i2c_p[i2c_pt].dev = dev;
+        i2c_p[i2c_pt].reg = reg;
+        i2c_p[i2c_pt].dat = dat;
+        i2c_p[i2c_pt].ptr = ptr;
+        gie = GIE;
+        GIE = 0;
+        i2c_pdone = false;
+        i2c_pt = nxt;
+        GIE = gie;
+    } else {
+        nxt = (i2c_qt + 1) & (I2C_QLEN - 1);
+        while(nxt == i2c_qh){
+            HAL_SPIN();
+        }
+        i2c_q[i2c_qt].dev = dev;
+        i2c_q[i2c_qt].reg = reg;
+        i2c_q[i2c_qt].dat = dat;
+        i2c_q[i2c_qt].ptr = ptr;
+        i2c_qt = nxt;
+    }
+    i2c_kick(pri);
+}
+
+void i2c_wait(void)
+{
+    while(i2c_st != I2C_IDLE){
+        HAL_SPIN();
+    }
+#if I2C_HW
+    i2c_idle();
+#endif
+}
+
+void bk_sync(uint8_t pri)
+{
+    uint8_t adr;
+    uint8_t msk;
+
+    // REG4-23 first, frequency REG2,1,0 last
+    for(uint8_t lp = 0; lp < BK_REGS; lp++){
+        CYC(14);
+        if(lp < 20){
+            adr = (uint8_t)(lp + 4);
+        } else {
+            adr = (uint8_t)(BK_REGS - 1 - lp);
+        }
+        msk = (uint8_t)(1 << (adr & 7));
+        if(bk_dirty[adr >> 3] & msk){
+            bk_dirty[adr >> 3] &= (uint8_t)~msk;
+            i2c_put(pri, I2C_ADR, adr, 0, NULL);
+        }
+    }
+}
+
+// BK4802 read-back
+//  START 0x90 reg, repeated START 0x91, MSB, LSB with NAK, STOP.
+//  Polled outside the queue, which is drained first. With I2C_HW the MSSP
+//  interrupt is masked, bit-banged i2c_lck keeps the tick off, so
+//  i2c_step() cannot run in between. About 0.7ms
+//  of bus time, returns 0 when the chip does not answer.
+uint16_t bk_rd(uint8_t adr)
+{
+    uint16_t dat = 0;
+
+    CYC(40);
+    i2c_wait();
+#if I2C_HW
+    SSP1IE = 0;
+#else
+    i2c_lck = true;
+#endif
+    i2c_start();
+    i2c_snd(I2C_ADR);
+    i2c_snd(adr);
+    i2c_rstart();
+    i2c_snd(I2C_ADR | 1);
+    if(i2c_ack()){
+        dat = (uint16_t)(i2c_rcv(true) << 8);
+        dat |= i2c_rcv(false);
+    }
+    i2c_stop();
+#if I2C_HW
+    i2c_idle();
+    SSP1IF = 0;
+    SSP1IE = 1;
+#else
+    i2c_lck = false;
+#endif
+    return dat;
+}
+
+uint8_t bk_rssi(void)
+{
+    return (uint8_t)(bk_rd(REG_RSSI) & 0x7F);
+}
+
+uint8_t bk_noise(void)
+{
+    return (uint8_t)(bk_rd(REG_NOISE) & 0x7F);
+}
+
+// RX profile, loaded once by bk_init(rcv_reg)
+const uint16_t rcv_reg[BK_REGS] = {
+    0x517b,     // REG0 433.02
+    0xde2c,
+    0x0000,
+    0x0000,
+    0x0300,
+    0x0c04,     // REG5
+    0xf140,
+    0xed00,
+    0x17e0,
+    0xe0e4,     // for 4802o
+//  0xe0e0,     // for 4802n?
+    0x8543,     // REG10
+    0x0700,
+    0xa066,
+    0xffff,
+    0xffe0,
+    0x061f,     // REG15
+    0x9e3c,
+    0x1f00,
+    0xd1d1,
+//  0x200f,     // VOL
+//  0x2400,     // VOL can not recv
+    0x2000,
+    0x01ff,     // REG20
+    0xe000,
+//  0x1800,     // SQL RSSI
+    0x0000,     // SQL RSSI recv 40h
+//  0x0300,     // SQL RSSI can not recv
+//  0xacd0
+//  0x0020      // SQL NOISE
+//  0x0000      // SQL NOISE  can not recv
+//  0x00F0      // SQL NOISE  can not recv
+    0x00e8      // SQL NOISE
+};
+
+// Registers that differ between RX and TX, TX values
+//  everything else in the TX profile equals rcv_reg[]
+#define TRX_REGS    6
+const uint8_t trx_adr[TRX_REGS] = {
+    4,
+    5,
+    18,
+    REG_VOL,
+    REG_SQL,
+    23
+};
+
+const uint16_t snd_dif[TRX_REGS] = {
+    0x7c00,     // REG4
+    0x0004,     // REG5
+    0xd1c1,     // REG18
+    0x200f,     // REG19
+    0x0340,     // REG22
+    0xaed0      // REG23
+};
+
+// Radio API
+//  bk_init()  full REG4-23 profile, once at boot
+//  bk_tune()  PLL words, REG2/1/0 only, then flushes what is dirty,
+//             bk_chan() does the same for a band channel
+//  rf_set()   band filter and RF amp, PORTC is written only on a change
+//  A channel step is then at most three register writes, REG2 drops out
+//  inside a band.
+void bk_init(const uint16_t *prf)
+{
+    for(uint8_t lp = 4; lp < BK_REGS; lp++){
+        bk_wr(lp, prf[lp]);
+    }
+}
+
 /*
  FREQ    RX              TX                      STEP
  29.00M 56ED B66A A000  5757 5757 A000
@@ -197,715 +855,825 @@ void i2c_snd(uint8_t data)
   + 64  5199 BE9B       51A0 58AA        1ED729
 */
 
-uint32_t frq_cal(uint8_t tr_mode, uint8_t fr_band, uint8_t fr_chan)
-{
-    // 29M
-    const uint32_t frq_029[3] = {
-        0x56EDB66A,
-        0x57575757,
-        0x000F6B94
-    };
-
-    // 51M
-    const uint32_t frq_051[3] = {
-        0x562AFBE1,
-        0x56666666,
-        0x0008AC84
-    };
-
-    // 144M
-    const uint32_t frq_144[3] = {
-        0x513D8324,
-        0x51515151,
-        0x0002E42B
-    };
-
-    // 145M
-    const uint32_t frq_145[3] = {
-        0x51CE13B5,
-        0x51E1E1E1,
-        0x0002E42B
-    };
-
-    // 431M
-    const uint32_t frq_431[3] = {
-        0x511A8712,
-        0x51212121,
-        0x0000F6B9
-    };
-
-    // 432M
-    const uint32_t frq_432[3] = {
-        0x514AB742,
-        0x51515151,
-        0x0000F6B9
-    };
-
-    // 433M
-    const uint32_t frq_433[3] = {
-        0x517AE772,
-        0x51818181,
-        0x0000F6B9
-    };
-
-    // 438M
-    const uint32_t frq_438[3] = {
-        0x526BD863,
-        0x52727272,
-        0x0000F6B9
-    };
-
-    uint32_t fr_base;
-    uint32_t fr_step;
-    uint32_t fr_calc;
-
-        switch (fr_band){
-            case 0:
-                fr_base = frq_029[tr_mode];
-                fr_step = frq_029[2];
-                break;
-            case 1:
-                fr_base = frq_051[tr_mode];
-                fr_step = frq_051[2];
-                break;
-            case 2:
-                fr_base = frq_144[tr_mode];
-                fr_step = frq_144[2];
-                break;
-            case 3:
-                fr_base = frq_145[tr_mode];
-                fr_step = frq_145[2];
-                break;
-            case 4:
-                fr_base = frq_431[tr_mode];
-                fr_step = frq_431[2];
-                break;
-            case 5:
-                fr_base = frq_432[tr_mode];
-                fr_step = frq_432[2];
-                break;
-            case 6:
-                fr_base = frq_433[tr_mode];
-                fr_step = frq_433[2];
-                break;
-            case 7:
-                fr_base = frq_438[tr_mode];
-                fr_step = frq_438[2];
-                break;
-            default:
-                fr_base = frq_438[tr_mode];
-                fr_step = frq_438[2];
-        }
+// PLL word synthesis
+//  word = (f - IF) * M * 2^32 / PLL_REF, IF in RX only, M is the divider
+//  selected by the REG2 band bits. frq_syn() takes the divider index,
+//  bk_chan() from the band row so word and REG2 always agree, bk_tune()
+//  from pll_div() for a free frequency. The VCO (f - IF) * M always stays
+//  below PLL_REF, so the word is a 0.32 fraction and comes out of a
+//  shift-and-subtract loop, no 32bit divide. Exact for every entry of
+//  the table above.
+#define PLL_REF     1360000000UL    // Hz
+#define PLL_IF      137000UL        // Hz, RX low side
+#define PLL_DIVS    4
+
+const uint32_t pll_lim[PLL_DIVS] = {
+    40000000,       // 28M
+    100000000,      // 50M
+    300000000,      // 144M
+    0xFFFFFFFF      // 430M
+};
+const uint8_t pll_mul[PLL_DIVS] = {16, 9, 3, 1};
+const uint16_t pll_bsw[PLL_DIVS] = {PLL_28, PLL_50, PLL_144, PLL_430};
+
+// Band plan
+//  one line per band: start (Hz), PLL divider, filter and the channel
+//  span in 10kHz. The const tables below are all expanded from this
+//  list, a band is added or moved here and nowhere else.
+#define BAND_LIST \
+    BND( 29000000, 0, BSW28,  100) \
+    BND( 51000000, 1, BSW50,  100) \
+    BND(144000000, 2, BSW144, 100) \
+    BND(145000000, 2, BSW144, 100) \
+    BND(431000000, 3, BSWTUN, 100) \
+    BND(432000000, 3, BSWTUN, 100) \
+    BND(433000000, 3, BSWTUN, 100) \
+    BND(438000000, 3, BSWTUN, 100)
+
+#define BND(frq, div, bsw, chs)    frq,
+const uint32_t band_frq[] = { BAND_LIST };
+#undef BND
+#define BND(frq, div, bsw, chs)    div,
+const uint8_t band_div[] = { BAND_LIST };
+#undef BND
+#define BND(frq, div, bsw, chs)    bsw,
+const uint8_t band_bsw[] = { BAND_LIST };
+#undef BND
+#define BND(frq, div, bsw, chs)    chs,
+const uint8_t band_chs[] = { BAND_LIST };
+#undef BND
+#define BANDS       (sizeof(band_frq) / sizeof(band_frq[0]))
+
+// the HEF record keeps the band in 3 bits
+#define BND(frq, div, bsw, chs)    +1
+#if (0 BAND_LIST) > 8
+#error "more than 8 bands do not fit the HEF record"
+#endif
+#undef BND
+
+uint32_t pll_rem;           // remainder of the last frq_syn(), 1/PLL_REF
+
+uint8_t pll_div(uint32_t f_hz)
+{
+    uint8_t div = 0;
 
-    fr_calc = fr_base + (fr_step * (uint32_t)(fr_chan >> 1));
-    return fr_calc;
+    while(f_hz >= pll_lim[div]){
+        CYC(16);
+        div++;
+    }
+    return div;
 }
 
-void rcv_set(uint8_t fr_band, uint8_t fr_chan, uint8_t af_vol, uint8_t sq_vol)
+uint32_t frq_syn(uint8_t tr_mode, uint32_t f_hz, uint8_t div)
 {
-    uint32_t pll_cal;
-    uint16_t frq_reg[3];
-    uint8_t data;
+    uint32_t vco;
+    uint32_t word = 0;
 
-    const uint16_t rcv_reg[24] = {
-        0x517b,     // REG0 433.02
-        0xde2c,
-        0x0000,
-        0x0000,
-        0x0300,
-        0x0c04,     // REG5
-        0xf140,
-        0xed00,
-        0x17e0,
-        0xe0e4,     // for 4802o
-//      0xe0e0,     // for 4802n?
-        0x8543,     // REG10
-        0x0700,
-        0xa066,
-        0xffff,
-        0xffe0,
-        0x061f,     // REG15
-        0x9e3c,
-        0x1f00,
-        0xd1d1,
-//      0x200f,     // VOL
-//      0x2400,     // VOL can not recv
-        0x2000,
-        0x01ff,     // REG20
-        0xe000,
-//      0x1800,     // SQL RSSI
-        0x0000,     // SQL RSSI recv 40h
-//      0x0300,     // SQL RSSI can not recv
-//      0xacd0
-//      0x0020      // SQL NOISE
-//      0x0000      // SQL NOISE  can not recv
-//      0x00F0      // SQL NOISE  can not recv
-        0x00e8      // SQL NOISE
-    };
-
-    pll_cal = frq_cal(0, fr_band, fr_chan);
-    frq_reg[0] = ((pll_cal >> 16) & 0x0000FFFF);
-    frq_reg[1] = (pll_cal & 0x0000FFFF);
-
-    RFAOFF;
-//  Filter
-    switch (fr_band){
-        case 0:
-            BSW28;
-            frq_reg[2] = PLL_28;
-            break;
-        case 1:
-            BSW50;
-            frq_reg[2] = PLL_50;
-            break;
-        case 2:
-            BSW144;
-            frq_reg[2] = PLL_144;
-            break;
-        case 3:
-            BSW144;
-            frq_reg[2] = PLL_144;
-            break;
-        case 4:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        case 5:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        case 6:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        case 7:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        default:
-            BSWTUN;
-            frq_reg[2] = PLL_430;
+    CYC(180);       // 32x8 multiply
+    vco = f_hz;
+    if(tr_mode == 0){
+        vco = vco - PLL_IF;
     }
-
-    // set
-    for(uint8_t lp = 4; lp < 24; lp++){
-
-    // Start
-        SDA_HIGH;
-        __delay_us(2);
-        SCK_HIGH;
-        __delay_us(2);
-        SDA_LOW;
-        __delay_us(2);
-        SCK_LOW;
-        __delay_us(2);
-    //
-        data = (uint8_t)(I2C_ADR & 0xFE );
-        i2c_snd(data);
-    //
-        data = (uint8_t)((lp) & 0xFF );
-        i2c_snd(data);
-    //
-        data = (uint8_t)((rcv_reg[lp] >> 8) & 0xFF );
-        i2c_snd(data);
-    //
-        if(lp == REG_VOL){
-//VOL
-            data = (uint8_t)((rcv_reg[lp] + af_vol) & 0xFF );
-        } else if(lp == REG_SQL){
-//SQL
-            data = (uint8_t)((rcv_reg[lp] + sq_vol) & 0xFF );
-        } else {
-            data = (uint8_t)(rcv_reg[lp] & 0xFF );
+    vco = vco * pll_mul[div];
+
+    for(uint8_t lp = 0; lp < 32; lp++){
+        CYC(28);
+        vco <<= 1;
+        word <<= 1;
+        if(vco >= PLL_REF){
+            vco -= PLL_REF;
+            word |= 1;
         }
-        i2c_snd(data);
-    // Stop
-        SCK_HIGH;
-        __delay_us(6);
-        SDA_HIGH;
-    // Wait
-        __delay_us(20);
     }
+    pll_rem = vco;
+    return word;
+}
 
-    for(uint8_t lp = 0; lp < 3; lp++){
-        uint16_t fdat;
-        uint8_t adr;
-        adr = (uint8_t)(2 - lp);
-        fdat = frq_reg[adr];
-
-    // Start
-        SDA_HIGH;
-        __delay_us(2);
-        SCK_HIGH;
-        __delay_us(2);
-        SDA_LOW;
-        __delay_us(2);
-        SCK_LOW;
-        __delay_us(2);
-    //
-        data = (uint8_t)(I2C_ADR & 0xFE);
-        i2c_snd(data);
-    //
-        data = (uint8_t)(adr & 0xFF);
-        i2c_snd(data);
-    //
-        data = (uint8_t)((fdat >> 8) & 0xFF);
-        i2c_snd(data);
-    //
-        data = (uint8_t)(fdat & 0xFF);
-        i2c_snd(data);
-    // Stop
-        SCK_HIGH;
-        __delay_us(6);
-        SDA_HIGH;
-    // Wait
-        __delay_us(20);
+uint32_t frq_hz(uint8_t fr_band, uint8_t fr_chan)
+{
+    CYC(420);       // 32x32 multiply
+    if(fr_band >= BANDS){
+        fr_band = BANDS - 1;
     }
+    return band_frq[fr_band] + (uint32_t)fr_chan * 10000;
 }
 
-void snd_set(uint8_t fr_band, uint8_t fr_chan, uint8_t po_vol)
-{
-    uint32_t pll_cal;
-    uint16_t frq_reg[3];
-    uint8_t data;
+// Tuning accumulator
+//  pll_chan() keeps, for RX and TX, the word of the last channel and the
+//  remainder of its division. A move of up to PLL_INC channels adds or
+//  subtracts one 10kHz step per channel (quotient pll_stq, remainder
+//  pll_str, carry as in Bresenham), a band change or a longer jump runs
+//  frq_syn() again. Same words as frq_syn() for every channel.
+#define PLL_INC     10      // chg_frh moves 10
 
-    const uint16_t snd_reg[24] = {
-        0x5182,     // REG0 433.02
-        0x783a,
-        0x0000,
-        0x0000,
-        0x7c00,
-        0x0004,     // REG5
-        0xf140,
-        0xed00,
-        0x17e0,
-        0xe0e4,
-        0x8543,     // REG10
-        0x0700,
-        0xa066,
-        0xffff,
-        0xffe0,
-        0x061f,     // REG15
-        0x9e3c,
-        0x1f00,
-        0xd1c1,
-        0x200f,
-        0x01ff,     // REG20
-        0xe000,
-        0x0340,
-        0xaed0
-    };
-
-    pll_cal = frq_cal(1, fr_band, fr_chan);
-    frq_reg[0] = ((pll_cal >> 16) & 0x0000FFFF);
-    frq_reg[1] = (pll_cal & 0x0000FFFF);
-
-    RFAON;
-//  Filter
-    switch (fr_band){
-        case 0:
-            BSW28;
-            frq_reg[2] = PLL_28;
-            break;
-        case 1:
-            BSW50;
-            frq_reg[2] = PLL_50;
-            break;
-        case 2:
-            BSW144;
-            frq_reg[2] = PLL_144;
-            break;
-        case 3:
-            BSW144;
-            frq_reg[2] = PLL_144;
-            break;
-        case 4:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        case 5:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        case 6:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        case 7:
-//          BSW430;
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-            break;
-        default:
-            BSWTUN;
-            frq_reg[2] = PLL_430;
-    }
+const uint32_t pll_stq[PLL_DIVS] = {0x7b5ca, 0x45641, 0x17215, 0x7b5c};
+const uint32_t pll_str[PLL_DIVS] = {367360000, 1056640000, 1258880000, 872960000};
 
-// set
-    for(uint8_t lp = 4; lp < 24; lp++){
+uint32_t pll_acc[2];
+uint32_t pll_ars[2];
+uint8_t pll_bnd[2] = {0xFF, 0xFF};
+uint8_t pll_chn[2];
 
-    // Start
-        SDA_HIGH;
-        __delay_us(2);
-        SCK_HIGH;
-        __delay_us(2);
-        SDA_LOW;
-        __delay_us(2);
-        SCK_LOW;
-        __delay_us(2);
-    //
-        data = (uint8_t)(I2C_ADR & 0xFE);
-        i2c_snd(data);
-    //
-        data = (uint8_t)(lp & 0xFF);
-        i2c_snd(data);
-    //
-        data = (uint8_t)((snd_reg[lp] >> 8) & 0xFF);
-        i2c_snd(data);
-    //
-        data = (uint8_t)(snd_reg[lp] & 0xFF);
-        i2c_snd(data);
-    // Stop
-        SCK_HIGH;
-        __delay_us(6);
-        SDA_HIGH;
-    // Wait
-        __delay_us(20);
+uint32_t pll_chan(uint8_t tr_mode, uint8_t fr_band, uint8_t fr_chan)
+{
+    uint32_t acc;
+    uint32_t rem;
+    uint32_t stq;
+    uint32_t str;
+    uint8_t chn;
+    uint8_t div;
+
+    CYC(60);
+    chn = pll_chn[tr_mode];
+    if((fr_band != pll_bnd[tr_mode])
+            || ((uint8_t)(fr_chan - chn + PLL_INC) > 2 * PLL_INC)){
+        pll_acc[tr_mode] = frq_syn(tr_mode, frq_hz(fr_band, fr_chan), band_div[fr_band]);
+        pll_ars[tr_mode] = pll_rem;
+        pll_bnd[tr_mode] = fr_band;
+        pll_chn[tr_mode] = fr_chan;
+        return pll_acc[tr_mode];
     }
 
-    for(uint8_t lp = 0; lp < 3; lp++){
-        uint16_t fdat;
-        uint8_t adr;
-        adr = (uint8_t)(2 - lp);
-        fdat = frq_reg[adr];
-
-    // Start
-        SDA_HIGH;
-        __delay_us(2);
-        SCK_HIGH;
-        __delay_us(2);
-        SDA_LOW;
-        __delay_us(2);
-        SCK_LOW;
-        __delay_us(2);
-    //
-        data = (uint8_t)(I2C_ADR & 0xFE );
-        i2c_snd(data);
-    //
-        data = (uint8_t)(adr & 0xFF );
-        i2c_snd(data);
-    //
-        data = (uint8_t)((fdat >> 8) & 0xFF );
-        i2c_snd(data);
-    //
-        data = (uint8_t)(fdat & 0xFF );
-        i2c_snd(data);
-    // Stop
-        SCK_HIGH;
-        __delay_us(6);
-        SDA_HIGH;
-    // Wait
-        __delay_us(20);
+    acc = pll_acc[tr_mode];
+    rem = pll_ars[tr_mode];
+    div = band_div[fr_band];
+    stq = pll_stq[div];
+    str = pll_str[div];
+    for(; chn < fr_chan; chn++){
+        CYC(30);
+        acc += stq;
+        rem += str;
+        if(rem >= PLL_REF){
+            rem -= PLL_REF;
+            acc++;
+        }
+    }
+    for(; chn > fr_chan; chn--){
+        CYC(30);
+        acc -= stq;
+        if(rem < str){
+            rem += PLL_REF;
+            acc--;
+        }
+        rem -= str;
     }
+    pll_acc[tr_mode] = acc;
+    pll_ars[tr_mode] = rem;
+    pll_chn[tr_mode] = chn;
+    return acc;
+}
+
+// Frequency text
+//  fr_bcd[] is the tuned frequency in kHz as 6 packed BCD digits, MSB
+//  first. A channel step adds one of the step constants (a step down is
+//  its ten's complement), band changes and recalls rebuild it from
+//  band_bcd[] and the channel by double dabble. The LCD only looks the
+//  digits up, nothing is divided at run time.
+#define BCD2(n)     ((uint8_t)(((((n) / 10) % 10) << 4) | ((n) % 10)))
+#define BND(frq, div, bsw, chs) \
+    {BCD2((frq) / 10000000), BCD2((frq) / 100000), BCD2((frq) / 1000)},
+const uint8_t band_bcd[][3] = { BAND_LIST };
+#undef BND
+
+const uint8_t bcd_up2[3]  = {0x00, 0x00, 0x20};     // +20kHz
+const uint8_t bcd_dn2[3]  = {0x99, 0x99, 0x80};     // -20kHz
+const uint8_t bcd_up10[3] = {0x00, 0x01, 0x00};     // +100kHz
+const uint8_t bcd_dn10[3] = {0x99, 0x99, 0x00};     // -100kHz
+
+uint8_t fr_bcd[3];
+
+// acc += add, mod 10^6
+void bcd_add(uint8_t *acc, const uint8_t *add)
+{
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t cy = 0;
+
+    for(uint8_t lp = 3; lp-- != 0; ){
+        CYC(32);
+        lo = (uint8_t)((acc[lp] & 0x0F) + (add[lp] & 0x0F) + cy);
+        cy = 0;
+        if(lo > 9){
+            lo -= 10;
+            cy = 1;
+        }
+        hi = (uint8_t)((acc[lp] >> 4) + (add[lp] >> 4) + cy);
+        cy = 0;
+        if(hi > 9){
+            hi -= 10;
+            cy = 1;
+        }
+        acc[lp] = (uint8_t)((hi << 4) | lo);
+    }
+}
+
+// 3 BCD digits, shift and add 3
+uint16_t bcd8(uint8_t bin)
+{
+    uint16_t bcd = 0;
+
+    for(uint8_t lp = 0; lp < 8; lp++){
+        CYC(24);
+        if((bcd & 0x000F) >= 0x0005){
+            bcd += 0x0003;
+        }
+        if((bcd & 0x00F0) >= 0x0050){
+            bcd += 0x0030;
+        }
+        bcd = (uint16_t)((bcd << 1) | (bin >> 7));
+        bin <<= 1;
+    }
+    return bcd;
+}
+
+void frq_bcd(uint8_t fr_band, uint8_t fr_chan, uint8_t *bcd)
+{
+    uint8_t off[3];
+    uint16_t ch;
+
+    CYC(40);
+    if(fr_band >= BANDS){
+        fr_band = BANDS - 1;
+    }
+    memcpy(bcd, band_bcd[fr_band], 3);
+    ch = bcd8(fr_chan);
+    off[0] = 0;
+    off[1] = (uint8_t)(ch >> 4);
+    off[2] = (uint8_t)(ch << 4);
+    bcd_add(bcd, off);
+}
+
+void bk_word(uint32_t pll_cal, uint16_t bsw, uint8_t pri)
+{
+    bk_wr(2, bsw);
+    bk_wr(1, (uint16_t)(pll_cal & 0x0000FFFF));
+    bk_wr(0, (uint16_t)((pll_cal >> 16) & 0x0000FFFF));
+    bk_sync(pri);
+}
+
+void bk_tune(uint8_t tr_mode, uint32_t f_hz, uint8_t pri)
+{
+    uint8_t div = pll_div(f_hz);
+
+    bk_word(frq_syn(tr_mode, f_hz, div), pll_bsw[div], pri);
+}
+
+// channel of a band, through the accumulator
+void bk_chan(uint8_t tr_mode, uint8_t fr_band, uint8_t fr_chan, uint8_t pri)
+{
+    if(fr_band >= BANDS){
+        fr_band = BANDS - 1;
+    }
+    bk_word(pll_chan(tr_mode, fr_band, fr_chan), pll_bsw[band_div[fr_band]], pri);
+}
+
+// Band filter and RF amp
+//  one masked LATC write from band_bsw[] and the amp bit, so there is no
+//  intermediate state. With RF_BBM the switch to TX first opens filter
+//  and amp for RF_BBM us, then makes the new path.
+uint8_t rf_lat = 0xFF;      // RF_MSK bits in LATC, 0xFF none yet
+
+void rf_set(uint8_t fr_band, uint8_t tr_mode)
+{
+    uint8_t lat;
+
+    CYC(20);
+    if(fr_band >= BANDS){
+        fr_band = BANDS - 1;
+    }
+    lat = band_bsw[fr_band];
+    if(tr_mode){
+        lat |= RFA;
+    }
+    if(lat == rf_lat){
+        return;
+    }
+#if RF_BBM
+    if(tr_mode){
+        LATC = (uint8_t)(LATC & ~RF_MSK);
+        __delay_us(RF_BBM);
+    }
+#endif
+    rf_lat = lat;
+    LATC = (uint8_t)((LATC & ~RF_MSK) | lat);
+}
+
+void rcv_set(uint8_t fr_band, uint8_t fr_chan, uint8_t af_vol, uint8_t sq_vol)
+{
+    uint16_t dat;
+    uint8_t adr;
+
+    TRC(TRC_RCV);
+    rf_set(fr_band, 0);
+
+    // set, common registers are loaded by bk_init()
+    for(uint8_t lp = 0; lp < TRX_REGS; lp++){
+        CYC(24);
+        adr = trx_adr[lp];
+        dat = rcv_reg[adr];
+        if(adr == REG_VOL){
+//VOL
+            dat = (dat & 0xFF00) | ((dat + af_vol) & 0x00FF);
+        } else if(adr == REG_SQL){
+//SQL
+            dat = (dat & 0xFF00) | ((dat + sq_vol) & 0x00FF);
+        }
+        bk_wr(adr, dat);
+    }
+
+    bk_chan(0, fr_band, fr_chan, false);
+    TRC(TRC_RCV + TRC_END);
+}
+
+void snd_set(uint8_t fr_band, uint8_t fr_chan, uint8_t po_vol)
+{
+    TRC(TRC_SND);
+    rf_set(fr_band, 1);
+
+// set, common registers are loaded by bk_init()
+    for(uint8_t lp = 0; lp < TRX_REGS; lp++){
+        bk_wr(trx_adr[lp], snd_dif[lp]);
+    }
+
+    bk_chan(1, fr_band, fr_chan, true);
+    TRC(TRC_SND + TRC_END);
 }
 
 void lcd_cmd(uint8_t cmd){
-    uint8_t data;
+    i2c_put(false, I2C_LCD, 0x00, cmd, NULL);
+}
 
-    // Start
-        SDA_HIGH;
-        __delay_us(2);
-        SCK_HIGH;
-        __delay_us(2);
-        SDA_LOW;
-        __delay_us(2);
-        SCK_LOW;
-        __delay_us(2);
-    //
-        data = (uint8_t)(I2C_LCD & 0xFE );
-        i2c_snd(data);
-    //
-        data = 0x00;
-        i2c_snd(data);
-    //
-        i2c_snd(cmd);
-    // Stop
-        SCK_HIGH;
-        __delay_us(6);
-        SDA_HIGH;
-    // Wait
-        __delay_us(20);
+void lcd_dsp(uint8_t chr){
+    i2c_put(false, I2C_LCD, 0x40, chr, NULL);
 }
 
-void lcd_init(){
-    __delay_ms(40);
+// Line buffer, sent as one continuous data write
+//  the ST7032 keeps taking characters after a single 0x40 control byte.
+//  lcd_shw[] holds what the display shows, lcd_out() only rewrites the
+//  runs that differ instead of clearing the display.
+#define LCD_W       8
+
+const uint8_t hex_asc[16] = "0123456789ABCDEF";
+
+uint8_t lcd_buf[LCD_W];
+uint8_t lcd_shw[LCD_W];
+uint8_t lcd_pos;
+
+void lcd_chr(uint8_t chr){
+    CYC(10);
+    if(lcd_pos < LCD_W){
+        lcd_buf[lcd_pos++] = chr;
+    }
+}
+
+void lcd_str(const uint8_t *str, uint8_t len){
+    if(len != 0){
+        i2c_put(false, I2C_LCD, 0x40, len, str);
+    }
+}
+
+void lcd_out(void){
+    uint8_t pos;
+    uint8_t end;
+
+    TRC(TRC_LCD);
+    while(lcd_pos < LCD_W){
+        lcd_buf[lcd_pos++] = ' ';
+    }
+    lcd_pos = 0;
+
+    pos = 0;
+    while(pos < LCD_W){
+        CYC(12);
+        if(lcd_buf[pos] == lcd_shw[pos]){
+            pos++;
+            continue;
+        }
+        end = pos;
+        while((end < LCD_W) && (lcd_buf[end] != lcd_shw[end])){
+            lcd_shw[end] = lcd_buf[end];
+            end++;
+        }
+        lcd_cmd((uint8_t)(0x80 | pos));     // DDRAM address
+        lcd_str(&lcd_shw[pos], (uint8_t)(end - pos));
+        pos = end;
+    }
+    TRC(TRC_LCD + TRC_END);
+}
+
+void lcd_put(uint8_t pos, uint8_t chr){
+    if(lcd_shw[pos] != chr){
+        lcd_shw[pos] = chr;
+        lcd_cmd((uint8_t)(0x80 | pos));
+        lcd_dsp(chr);
+    }
+}
+
+void lcd_clr(void){
+    lcd_cmd(0x01);      // Clear Display
+    memset(lcd_shw, ' ', LCD_W);
+    i2c_wait();
+    __delay_ms(2);      // 1.08ms execution
+}
+
+// ST7032 power-up
+//  LCD_TPON from VDD to the first command, LCD_TFOL after follower
+//  control for the booster to settle. lcd_init() waits them out, the
+//  boot path leaves them to lcd_boot() in lcd_task so the radio is not
+//  held up behind the display.
+#define LCD_TPON    40      // ms
+#define LCD_TFOL    200     // ms
+#define LCD_TSK     20      // ms, lcd_task period
+
+#define LCD_PON     0
+#define LCD_FOL     1
+#define LCD_RDY     2
+
+uint8_t lcd_stg = LCD_PON;
+uint8_t lcd_tmr = LCD_TPON / LCD_TSK;
+
+void lcd_pwr(void){
     lcd_cmd(0x38);      // Function set
     lcd_cmd(0x39);      // Function set w/ IS bit
     lcd_cmd(0x14);      // Internal OSC freq
     lcd_cmd(0x70);      // Contrast set
     lcd_cmd(0x56);      // Power/ICON/Contrast control
     lcd_cmd(0x6C);      // Follower control
-    __delay_ms(200);
+}
+
+void lcd_on(void){
 //  lcd_cmd(0x38);      // 2 Function set w/o IS bit
     lcd_cmd(0x34);      // 1 Function set w/o IS bit
     lcd_cmd(0x0C);      // Display On
-    lcd_cmd(0x01);      // Clear Display
 }
 
-void lcd_dsp(uint8_t chr){
-    uint8_t data;
-
-    // Start
-        SDA_HIGH;
-        __delay_us(2);
-        SCK_HIGH;
-        __delay_us(2);
-        SDA_LOW;
-        __delay_us(2);
-        SCK_LOW;
-        __delay_us(2);
-    //
-        data = (uint8_t)(I2C_LCD & 0xFE );
-        i2c_snd(data);
-    //
-        data = 0x40;
-        i2c_snd(data);
-    //
-        i2c_snd(chr);
-    // Stop
-        SCK_HIGH;
-        __delay_us(6);
-        SDA_HIGH;
-    // Wait
-        __delay_us(20);
+void lcd_init(){
+    __delay_ms(LCD_TPON);
+    lcd_pwr();
+    i2c_wait();
+    __delay_ms(LCD_TFOL);
+    lcd_on();
+    lcd_clr();
+    lcd_stg = LCD_RDY;
 }
 
-void lcd_txmode(void){
-    lcd_cmd(0x02);      // Home
-    lcd_dsp('T');
+// lcd_init() one step per lcd_task run, the clear (1.08ms) is over by
+// the next run
+void lcd_boot(void){
+    if(lcd_tmr != 0){
+        lcd_tmr--;
+        return;
+    }
+    if(lcd_stg == LCD_PON){
+        lcd_pwr();
+        lcd_stg = LCD_FOL;
+        lcd_tmr = LCD_TFOL / LCD_TSK;
+    } else {
+        lcd_on();
+        lcd_cmd(0x01);  // Clear Display
+        memset(lcd_shw, ' ', LCD_W);
+        lcd_stg = LCD_RDY;
+    }
 }
 
 void lcd_rxmode(void){
-    lcd_cmd(0x02);      // Home
-    lcd_dsp('R');
+    lcd_put(0, 'R');
 }
 
 void lcd_mode(uint8_t set_md){
     switch (set_md){
         case 0:
-            lcd_dsp('R');
-            lcd_dsp('X');
+            lcd_chr('R');
+            lcd_chr('X');
             break;
 
         case 1:
-            lcd_dsp('B');
-            lcd_dsp(' ');
+            lcd_chr('B');
+            lcd_chr(' ');
             break;
 
         case 2:
-            lcd_dsp('H');
-            lcd_dsp(' ');
+            lcd_chr('H');
+            lcd_chr(' ');
             break;
 
         case 3:
-            lcd_dsp('L');
-            lcd_dsp(' ');
+            lcd_chr('L');
+            lcd_chr(' ');
             break;
 
         case 4:
-            lcd_dsp('V');
-            lcd_dsp(' ');
+            lcd_chr('V');
+            lcd_chr(' ');
             break;
 
         case 5:
-            lcd_dsp('S');
-            lcd_dsp(' ');
+            lcd_chr('S');
+            lcd_chr(' ');
             break;
 
         case 6:
-            lcd_dsp('P');
-            lcd_dsp(' ');
+            lcd_chr('P');
+            lcd_chr(' ');
             break;
 
-        default:
-            lcd_cmd(0x14);
-            lcd_cmd(0x14);
-    }
-}
-
-void lcd_band(uint8_t fr_band){
-    switch (fr_band){
-        case 0:
-            lcd_dsp(' ');
-            lcd_dsp('2');
-            lcd_dsp('9');
-            break;
-        case 1:
-            lcd_dsp(' ');
-            lcd_dsp('5');
-            lcd_dsp('1');
-            break;
-        case 2:
-            lcd_dsp('1');
-            lcd_dsp('4');
-            lcd_dsp('4');
-            break;
-        case 3:
-            lcd_dsp('1');
-            lcd_dsp('4');
-            lcd_dsp('5');
-            break;
-        case 4:
-            lcd_dsp('4');
-            lcd_dsp('3');
-            lcd_dsp('1');
+        case 7:
+            lcd_chr('M');
+            lcd_chr(' ');
             break;
-        case 5:
-            lcd_dsp('4');
-            lcd_dsp('3');
-            lcd_dsp('2');
+
+        case 8:
+            lcd_chr('S');
+            lcd_chr('C');
             break;
-        case 6:
-            lcd_dsp('4');
-            lcd_dsp('3');
-            lcd_dsp('3');
+
+        case 9:
+            lcd_chr('T');
+            lcd_chr('X');
             break;
-        case 7:
-            lcd_dsp('4');
-            lcd_dsp('3');
-            lcd_dsp('4');
+
+        case 10:
+            lcd_chr('S');
+            lcd_chr('M');
             break;
+
         default:
-            lcd_dsp('e');
-            lcd_dsp('r');
-            lcd_dsp('r');
-        }
+            lcd_chr(' ');
+            lcd_chr(' ');
+    }
 }
 
-void lcd_ch(uint8_t set_md, uint8_t fr_band, uint8_t fr_chan){
-    uint8_t ch_h = 0;
-    uint8_t ch_l = 0;
+// "433.02" from 100MHz on, "29.000" below, cut at the line end
+void lcd_frq(const uint8_t *bcd){
+    if(bcd[0] & 0xF0){
+        lcd_chr(hex_asc[bcd[0] >> 4]);
+        lcd_chr(hex_asc[bcd[0] & 0x0F]);
+        lcd_chr(hex_asc[bcd[1] >> 4]);
+        lcd_chr('.');
+        lcd_chr(hex_asc[bcd[1] & 0x0F]);
+        lcd_chr(hex_asc[bcd[2] >> 4]);
+    } else {
+        lcd_chr(hex_asc[bcd[0] & 0x0F]);
+        lcd_chr(hex_asc[bcd[1] >> 4]);
+        lcd_chr('.');
+        lcd_chr(hex_asc[bcd[1] & 0x0F]);
+        lcd_chr(hex_asc[bcd[2] >> 4]);
+        lcd_chr(hex_asc[bcd[2] & 0x0F]);
+    }
+}
 
-    lcd_cmd(0x01);      // Clear
+void lcd_ch(uint8_t set_md, const uint8_t *bcd){
     lcd_mode(set_md);
-    lcd_band(fr_band);
-
-    ch_h = fr_chan / 10;
-    ch_l = fr_chan % 10;
-    lcd_dsp('.');
-    lcd_dsp('0' + ch_h);
-    lcd_dsp('0' + ch_l);
+    lcd_frq(bcd);
+    lcd_out();
 }
 
 void lcd_fnc(uint8_t fnc, uint8_t vol){
-    uint8_t vol_h;
-    uint8_t vol_l;
-
-    vol_h = (vol >> 4);
-    vol_l = vol - (vol_h * 16);
-
-    lcd_cmd(0x01);      // Clear
-
     switch (fnc){
         case 4:
-            lcd_dsp('V');
-            lcd_dsp(' ');
+            lcd_chr('V');
+            lcd_chr(' ');
             break;
 
         case 5:
-            lcd_dsp('S');
-            lcd_dsp(' ');
+            lcd_chr('S');
+            lcd_chr(' ');
             break;
 
         case 6:
-            lcd_dsp('P');
-            lcd_dsp(' ');
+            lcd_chr('P');
+            lcd_chr(' ');
             break;
 
         default:
-            lcd_dsp(' ');
-            lcd_dsp(' ');
+            lcd_chr(' ');
+            lcd_chr(' ');
     }
 
-    lcd_dsp(' ');
+    lcd_chr(' ');
+    lcd_chr(hex_asc[vol >> 4]);
+    lcd_chr(hex_asc[vol & 0x0F]);
+    lcd_out();
+}
+
+// Ladder classifier
+//  key_lut[] holds the key for every 4 levels of the 8 bit ADC value, so
+//  sw_lvl() is one lookup. key_map() fills it from key_thr[], the levels
+//  between neighbouring keys in ladder order, REF_* until key_cal() has
+//  measured the board.
+#define KEY_LVLS    7
+#define KEY_LUT     64
 
-    if(vol_h > 9){
-        lcd_dsp('A' + vol_h -10);
-    } else {
-        lcd_dsp('0' + vol_h);
+const uint8_t key_ord[KEY_LVLS] = {STAT_OP, STAT_LT, STAT_RT, STAT_CT, STAT_UP, STAT_DN, STAT_PT};
+
+uint8_t key_thr[KEY_LVLS - 1] = {REF_OP, REF_LT, REF_RT, REF_CT, REF_UP, REF_DN};
+uint8_t key_lut[KEY_LUT];
+uint8_t key_hef;            // key_thr[] from key_cal(), kept in HEF
+
+// thresholds falling in ladder order
+uint8_t key_chk(const uint8_t *thr)
+{
+    for(uint8_t lp = 1; lp < KEY_LVLS - 1; lp++){
+        if(thr[lp] >= thr[lp - 1]){
+            return false;
+        }
     }
-    if(vol_l > 9){
-        lcd_dsp('A' + vol_l -10);
-    } else {
-        lcd_dsp('0' + vol_l);
+    return true;
+}
+
+void key_map(void)
+{
+    uint8_t lvl;
+    uint8_t key;
+
+    for(uint8_t lp = 0; lp < KEY_LUT; lp++){
+        lvl = (uint8_t)(lp * 4 + 2);    // middle of the entry
+        key = 0;
+        while((key < KEY_LVLS - 1) && (lvl <= key_thr[key])){
+            key++;
+        }
+        key_lut[lp] = key_ord[key];
     }
 }
 
-uint8_t sw_state(void)
+uint8_t sw_lvl(uint8_t cmp_val)
+{
+    CYC(8);
+    return key_lut[cmp_val >> 2];
+}
+
+uint8_t sw_adc(void)
 {
     uint16_t adc_val;
-    uint8_t cmp_val;
-    __delay_us(20);
-    GO_nDONE = 1;
-    while(GO_nDONE) ;
+
+    __delay_us(ADC_ACQ);
+    ADC_START();
+    while(ADC_BUSY()) ;
     adc_val = ADRESH;
     adc_val = ( adc_val << 8 ) | ADRESL;
-    cmp_val = (uint8_t)(adc_val >> 2);
-
-//  lcd_cmd(0x01);
-//  lcd_dsp(((cmp_val & 0xF0) >> 4) + '0');
-//  lcd_dsp(((cmp_val & 0x0F)     ) + '0');
-
-    if(cmp_val > REF_OP)
-        return (STAT_OP);
-    else if(cmp_val > REF_LT)
-        return (STAT_LT);
-    else if(cmp_val > REF_RT)
-        return (STAT_RT);
-    else if(cmp_val > REF_CT)
-        return (STAT_CT);
-    else if(cmp_val > REF_UP)
-        return (STAT_UP);
-    else if(cmp_val > REF_DN)
-        return (STAT_DN);
-    else
-        return (STAT_PT);
-}
-
-void sw_check(void)
+    return (uint8_t)(adc_val >> 2);
+}
+
+uint8_t sw_state(void)
 {
-    uint16_t adc_val;
-    uint8_t cmp_val;
-
-    for(uint8_t i = 0; i < 10; i++){
-        __delay_us(100);
-        GO_nDONE = 1;
-        while(GO_nDONE) ;
-        adc_val = ADRESH;
-        adc_val = ( adc_val << 8 ) | ADRESL;
-        cmp_val = (uint8_t)(adc_val >> 2);
-
-        lcd_cmd(0x01);
-        if((((cmp_val & 0xF0) >> 4) + '0') > '9')
-            lcd_dsp(((cmp_val & 0xF0) >> 4) + 'A' -10);
-        else
-            lcd_dsp(((cmp_val & 0xF0) >> 4) + '0');
-
-        if((((cmp_val & 0x0F)     ) + '0') > '9')
-            lcd_dsp(((cmp_val & 0x0F)     ) + 'A' -10);
-        else
-            lcd_dsp(((cmp_val & 0x0F)     ) + '0');
-        
-        __delay_ms(100);
+    return sw_lvl(sw_adc());
+}
+
+// Joystick sampler
+//  Timer0 ticks every 1ms and starts a conversion every KEY_SMP ticks,
+//  the ADC interrupt feeds key_smp(). A level has to be seen KEY_DEB
+//  times in a row before it is taken, then press/repeat/release events
+//  are queued for the main loop. sw_state() is only for use before
+//  key_init().
+#define KEY_SMP     2       // ms per sample
+#define KEY_DEB     4       // samples
+#define KEY_DLY     200     // samples to first repeat
+#define KEY_RPT     50      // samples per repeat
+#define KEY_QLEN    4       // power of 2
+
+#define EVT_PRS     0x10
+#define EVT_RPT     0x20
+#define EVT_REL     0x40
+#define EVT_KEY     0x07
+
+volatile uint8_t tick_ms;
+volatile uint8_t key_now = STAT_OP;     // debounced state
+uint8_t key_raw = STAT_OP;
+uint8_t key_cnt;
+uint8_t key_rpt;
+uint8_t key_div;
+uint8_t key_q[KEY_QLEN];
+volatile uint8_t key_qh, key_qt;
+
+void key_put(uint8_t evt)
+{
+    uint8_t nxt;
+
+    if(evt & EVT_PRS){
+        TRC(TRC_KEY + (evt & EVT_KEY));
+    } else if(evt & EVT_REL){
+        TRC(TRC_KEY + (evt & EVT_KEY) + TRC_END);
+    }
+    nxt = (key_qt + 1) & (KEY_QLEN - 1);
+    if(nxt != key_qh){
+        key_q[key_qt] = evt;
+        key_qt = nxt;
+    }
+}
+
+uint8_t key_get(void)
+{
+    uint8_t evt;
+
+    if(key_qh == key_qt){
+        return 0;
+    }
+    evt = key_q[key_qh];
+    key_qh = (key_qh + 1) & (KEY_QLEN - 1);
+    return evt;
+}
+
+void key_smp(uint8_t raw)
+{
+    CYC(20);
+    if(raw != key_raw){
+        key_raw = raw;
+        key_cnt = 0;
+    } else if(key_cnt < KEY_DEB){
+        key_cnt++;
+    } else if(raw != key_now){
+        if(key_now != STAT_OP){
+            key_put(EVT_REL | key_now);
+        }
+        key_now = raw;
+        key_rpt = KEY_DLY;
+        if(raw != STAT_OP){
+            key_put(EVT_PRS | raw);
+        }
+    } else if(key_now != STAT_OP){
+        if(--key_rpt == 0){
+            key_rpt = KEY_RPT;
+            key_put(EVT_RPT | key_now);
+        }
+    }
+}
+
+void key_init(void)
+{
+    TMR0 = TMR0_RLD;
+    TMR0IF = 0;
+    TMR0IE = 1;
+    ADIF = 0;
+    ADIE = 1;
+    PEIE = 1;
+    GIE = 1;
+}
+
+#if TRACE
+// Trace dump, oldest entry first, one "II TTTT" line per entry
+#define TRC_BRG     ((uint16_t)((uint32_t)CLK_MHZ * 1000000 / 4 / TRC_BAUD - 1))
+
+#if defined(_16F1705)
+void trc_tx(uint8_t chr)
+{
+    while(TXIF == 0) ;
+    TX1REG = chr;
+}
+#endif
+
+void trc_dump(void)
+{
+    uint8_t pos;
+    uint8_t line[7];
+    trc_ent ent;
+
+    trc_on = false;
+#if defined(_16F1705)
+    RA5PPS = 0x14;          // TX
+    SP1BRGL = (uint8_t)(TRC_BRG & 0xFF);
+    SP1BRGH = (uint8_t)(TRC_BRG >> 8);
+    BAUD1CON = 0b00001000;  // BRG16
+    TX1STA = 0b00100100;    // TXEN BRGH
+    RC1STA = 0b10000000;    // SPEN
+#endif
+    pos = trc_pos;
+    for(uint8_t lp = 0; lp < TRC_LEN; lp++){
+        ent = trc_buf[pos];
+        pos = (pos + 1) & (TRC_LEN - 1);
+        if(ent.id == 0){
+            continue;
+        }
+        line[0] = hex_asc[ent.id >> 4];
+        line[1] = hex_asc[ent.id & 0x0F];
+        line[2] = ' ';
+        line[3] = hex_asc[(ent.t >> 12) & 0x0F];
+        line[4] = hex_asc[(ent.t >> 8) & 0x0F];
+        line[5] = hex_asc[(ent.t >> 4) & 0x0F];
+        line[6] = hex_asc[ent.t & 0x0F];
+        for(uint8_t i = 0; i < sizeof(line); i++){
+#if defined(_16F1705)
+            trc_tx(line[i]);
+#else
+            lcd_chr(line[i]);
+#endif
+        }
+#if defined(_16F1705)
+        trc_tx('\r');
+        trc_tx('\n');
+#else
+        lcd_out();
+        __delay_ms(300);
+#endif
     }
+#if defined(_16F1705)
+    while(TRMT == 0) ;
+    RC1STA = 0;
+    RA5PPS = 0;             // LATA5
+#endif
+    trc_aft = 0;
+    trc_on = true;
 }
+#endif
 
 void joys_chk(void){
     uint8_t joys;
@@ -943,7 +1711,25 @@ void joys_chk(void){
         if(joys != STAT_OP){
             __delay_ms(200);
         }
-        lcd_cmd(0x01);
+        lcd_clr();
+    }
+}
+
+// LED flash, turned off by led_task()
+uint8_t led_tmr;
+
+void led_on(uint8_t ms)
+{
+    LED_ON;
+    led_tmr = ms;
+}
+
+void led_task(void)
+{
+    if(led_tmr != 0){
+        if(--led_tmr == 0){
+            LED_OFF;
+        }
     }
 }
 
@@ -952,24 +1738,20 @@ uint8_t chg_vol(uint8_t joys, uint8_t af_old){
     af_vol = af_old;
         switch (joys){
             case STAT_DN:
-                LED_ON;
+                led_on(10);
                 if(af_vol <= 0){
                     af_vol = 0;
                 } else {
                     af_vol = af_vol - 1;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             case STAT_UP:
-                LED_ON;
+                led_on(10);
                 if(af_vol >= 15){
                     af_vol = 15;
                 } else {
                     af_vol = af_vol + 1;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             default:
                 ;
@@ -982,24 +1764,20 @@ uint8_t chg_sql(uint8_t joys, uint8_t sq_old){
     sq_vol = sq_old;
         switch (joys){
             case STAT_DN:
-                LED_ON;
+                led_on(10);
                 if(sq_vol < 4){
                     sq_vol = 0;
                 } else {
                     sq_vol = sq_vol - 4;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             case STAT_UP:
-                LED_ON;
+                led_on(10);
                 if(sq_vol >= 0xFC){
                     sq_vol = 0xFC;
                 } else {
                     sq_vol = sq_vol + 4;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             default:
                 ;
@@ -1012,24 +1790,20 @@ uint8_t chg_pow(uint8_t joys, uint8_t po_old){
     po_vol = po_old;
         switch (joys){
             case STAT_DN:
-                LED_ON;
+                led_on(10);
                 if(po_vol <= 0){
                     po_vol = 0;
                 } else {
                     po_vol = po_vol - 1;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             case STAT_UP:
-                LED_ON;
+                led_on(10);
                 if(po_vol >= 7){
                     po_vol = 7;
                 } else {
                     po_vol = po_vol + 1;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             default:
                 ;
@@ -1042,24 +1816,20 @@ uint8_t chg_frb(uint8_t joys, uint8_t fr_old){
     fr_band = fr_old;
         switch (joys){
             case STAT_DN:
-                LED_ON;
+                led_on(10);
                 if(fr_band == 0){
-                    fr_band = 7;
+                    fr_band = BANDS - 1;
                 } else {
                     fr_band--;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             case STAT_UP:
-                LED_ON;
-                if(fr_band >= 7){
+                led_on(10);
+                if(fr_band >= BANDS - 1){
                     fr_band = 0;
                 } else {
                     fr_band++;
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             default:
                 ;
@@ -1067,147 +1837,832 @@ uint8_t chg_frb(uint8_t joys, uint8_t fr_old){
         return fr_band;
 }
 
-uint8_t chg_frh(uint8_t joys, uint8_t fr_old){
+uint8_t chg_frh(uint8_t joys, uint8_t fr_old, uint8_t fr_band){
     uint8_t fr_chan;
+    uint8_t chs = band_chs[fr_band];
     fr_chan = fr_old;
         switch (joys){
             case STAT_DN:
-                LED_ON;
+                led_on(10);
                 if(fr_chan < 10){
-                    fr_chan = fr_chan + 90;
+                    fr_chan = fr_chan + chs - 10;
+                    frq_bcd(fr_band, fr_chan, fr_bcd);
                 } else {
                     fr_chan = fr_chan - 10;
+                    bcd_add(fr_bcd, bcd_dn10);
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             case STAT_UP:
-                LED_ON;
+                led_on(10);
                 fr_chan = fr_chan + 10;
-                if(fr_chan >= 100){
-                    fr_chan = fr_chan - 100;
+                if(fr_chan >= chs){
+                    fr_chan = fr_chan - chs;
+                    frq_bcd(fr_band, fr_chan, fr_bcd);
+                } else {
+                    bcd_add(fr_bcd, bcd_up10);
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             default:
                 ;
         }
-        if(fr_chan >= 100){
+        if(fr_chan >= chs){
             fr_chan = 0;
+            frq_bcd(fr_band, fr_chan, fr_bcd);
         }
         return fr_chan;
 }
 
-uint8_t chg_frl(uint8_t joys, uint8_t fr_old){
+uint8_t chg_frl(uint8_t joys, uint8_t fr_old, uint8_t fr_band){
     uint8_t fr_chan;
+    uint8_t chs = band_chs[fr_band];
     fr_chan = fr_old;
         switch (joys){
             case STAT_DN:
-                LED_ON;
+                led_on(10);
                 if(fr_chan == 0){
-                    fr_chan = 98;
+                    fr_chan = chs - 2;
+                    frq_bcd(fr_band, fr_chan, fr_bcd);
                 } else {
                     fr_chan = fr_chan - 2;
+                    bcd_add(fr_bcd, bcd_dn2);
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             case STAT_UP:
-                LED_ON;
-                if(fr_chan >= 98){
+                led_on(10);
+                if(fr_chan >= chs - 2){
                     fr_chan = 0;
+                    frq_bcd(fr_band, fr_chan, fr_bcd);
                 } else {
                     fr_chan = fr_chan + 2;
+                    bcd_add(fr_bcd, bcd_up2);
                 }
-                __delay_ms(10);
-                LED_OFF;
                 break ;
             default:
                 ;
         }
-        if(fr_chan >= 100){
+        if(fr_chan >= chs){
             fr_chan = 0;
+            frq_bcd(fr_band, fr_chan, fr_bcd);
         }
         return fr_chan;
 }
 
-void main(void) {
-
-    uint8_t flag = RECV;
-    uint8_t freq = 5;
-    uint8_t joys;
-    uint8_t set_md = 0;
-    uint8_t s_timer = 0;
-    uint8_t af_vol = 10;
-    uint8_t sq_vol = 0x40;
-    uint8_t po_vol = 7;
-    uint8_t fr_band = 6;
-    uint8_t fr_chan = 0;
+// Tick scheduler
+//  every task runs at a fixed period of Timer0 ticks from sch_run(),
+//  Timer1 counts instruction cycles to record how long each run took.
+typedef struct {
+    void (*fn)(void);
+    uint8_t per;        // ms
+    uint8_t nxt;        // next deadline, tick_ms
+    uint16_t run;       // last run time, Tcy
+    uint16_t max;       // worst run time, Tcy
+} sch_task;
+
+uint8_t flag = RECV;
+uint8_t set_md = 0;
+uint8_t s_timer = 0;    // menu timeout, 50ms
+uint8_t af_vol = 10;
+uint8_t sq_vol = 0x40;
+uint8_t po_vol = 7;
+uint8_t fr_band = 6;
+uint8_t fr_chan = 0;
+uint8_t lcd_req = true;
+
+#define MEM_CHS     4       // <= HEF_SLOTS - 4
+uint8_t mem_ch[MEM_CHS][3];     // packed as b0-b2 (see HEF), b0 0xFF empty
+uint8_t mem_sel;
+
+// Scanner
+//  steps fr_chan round the band with bk_chan(), only REG0/REG1 go out
+//  per hop since REG2 and the filter do not change inside a band. They
+//  go out as priority entries, ahead of the LCD redraw. SCN_LOCK ms later the
+//  RSSI decides: below SCN_THR move on, otherwise dwell until the carrier
+//  has been gone for SCN_HANG ms. SCN_MAX != 0 also resumes after that
+//  many ms on a busy channel.
+//  With scn_mem set the hops go round the stored mem_ch[] entries instead,
+//  empty ones skipped. A memory may be on another band, rf_set() switches
+//  the filter and bk_chan() sends REG2 along when it changes. The scan
+//  stops when no memory is stored.
+#ifndef SCN_THR
+#define SCN_THR     0x30    // RSSI gate
+#endif
+#define SCN_LOCK    2       // ms, PLL lock and RSSI settle
+#define SCN_SMP     20      // ms, RSSI poll while dwelling
+#define SCN_HANG    2000    // ms
+#define SCN_MAX     0       // ms, 0:dwell while the carrier lasts
+
+#define SCN_OFF     0
+#define SCN_LCK     1
+#define SCN_DWL     2
+
+uint8_t scn_st = SCN_OFF;
+uint8_t scn_mem;            // true: the memories, false: the band
+uint8_t scn_dir = 2;        // 2:up 0xFE:down
+uint8_t scn_tmr;
+uint16_t scn_hng;
+#if SCN_MAX
+uint16_t scn_dwl;
+#endif
+
+// next stored memory from mem_sel on, false none stored
+uint8_t scn_mnxt(void)
+{
+    for(uint8_t lp = 0; lp < MEM_CHS; lp++){
+        if(scn_dir == 2){
+            mem_sel = (mem_sel >= MEM_CHS - 1) ? 0 : (uint8_t)(mem_sel + 1);
+        } else {
+            mem_sel = (mem_sel == 0) ? (uint8_t)(MEM_CHS - 1) : (uint8_t)(mem_sel - 1);
+        }
+        if(mem_ch[mem_sel][0] == 0xFF){
+            continue;
+        }
+        fr_band = (uint8_t)(mem_ch[mem_sel][0] >> 5);
+        if(fr_band >= BANDS){
+            fr_band = BANDS - 1;
+        }
+        fr_chan = mem_ch[mem_sel][1];
+        if(fr_chan >= band_chs[fr_band]){
+            fr_chan = 0;
+        }
+        return true;
+    }
+    return false;
+}
 
-//Initialize
-    port_init();
-    lcd_init();
-    __delay_ms(100);
-//  sw_check();
-    joys_chk();
-    __delay_ms(100);
-    lcd_ch(set_md, fr_band, fr_chan);
-    rcv_set(fr_band, fr_chan, 10, 0x48);
-    __delay_ms(100);
+void scn_hop(void)
+{
+    if(scn_mem){
+        if(scn_mnxt() == false){
+            scn_st = SCN_OFF;
+            scn_mem = false;
+            lcd_req = true;
+            return;
+        }
+        frq_bcd(fr_band, fr_chan, fr_bcd);
+        rf_set(fr_band, 0);
+    } else {
+        fr_chan = (uint8_t)(fr_chan + scn_dir);
+        if(fr_chan >= band_chs[fr_band]){
+            fr_chan = (scn_dir == 2) ? 0 : (uint8_t)(band_chs[fr_band] - 2);
+            frq_bcd(fr_band, fr_chan, fr_bcd);
+        } else {
+            bcd_add(fr_bcd, (scn_dir == 2) ? bcd_up2 : bcd_dn2);
+        }
+    }
+    bk_chan(0, fr_band, fr_chan, true);
+    scn_st = SCN_LCK;
+    scn_tmr = SCN_LOCK;
+    lcd_req = true;
+}
 
-//Loop
-    while(1){
-        joys = sw_state();
-        __delay_ms(1);
-
-// Change
-        if(s_timer > 0){
-            switch (set_md){
-                case 1:
-                    fr_band = chg_frb(joys, fr_band);
-                    lcd_ch(set_md, fr_band, fr_chan);
-                    break;
-                case 2:
-                    fr_chan = chg_frh(joys, fr_chan);
-                    lcd_ch(set_md, fr_band, fr_chan);
-                    break;
-                case 3:
-                    fr_chan = chg_frl(joys, fr_chan);
-                    lcd_ch(set_md, fr_band, fr_chan);
-                    break;
-                case 4:
-                    af_vol = chg_vol(joys, af_vol);
-                    lcd_fnc(set_md, af_vol);
-                    break;
-                case 5:
-                    sq_vol = chg_sql(joys, sq_vol);
-                    lcd_fnc(set_md, sq_vol);
-                    break;
-                case 6:
-                    po_vol = chg_pow(joys, po_vol);
-                    lcd_fnc(set_md, po_vol);
-                    break;
-                default:
-                    ;
+void scn_task(void)
+{
+    switch (scn_st){
+        case SCN_LCK:
+            if(--scn_tmr != 0){
+                break;
             }
-        }
+            if(bk_rssi() < SCN_THR){
+                scn_hop();
+                break;
+            }
+            led_on(10);
+            scn_st = SCN_DWL;
+            scn_tmr = SCN_SMP;
+            scn_hng = SCN_HANG;
+#if SCN_MAX
+            scn_dwl = SCN_MAX;
+#endif
+            break;
+        case SCN_DWL:
+#if SCN_MAX
+            if(--scn_dwl == 0){
+                scn_hop();
+                break;
+            }
+#endif
+            if(--scn_tmr != 0){
+                break;
+            }
+            scn_tmr = SCN_SMP;
+            if(bk_rssi() >= SCN_THR){
+                scn_hng = SCN_HANG;
+            } else if(scn_hng > SCN_SMP){
+                scn_hng -= SCN_SMP;
+            } else {
+                scn_hop();
+            }
+            break;
+        default:
+            ;
+    }
+}
 
-        switch (joys){
-// left/right
-            case STAT_RT:
-                LED_ON;
-                if(set_md >=6){
-                    set_md = 6;
-                } else {
-                    set_md++;
-                }
-                s_timer = 50;
-                __delay_ms(120);
-                LED_OFF;
-                break ;
-            case STAT_LT:
-                LED_ON;
+// Settings and memory channels in High-Endurance Flash
+//  The 128 HEF words hold one byte each (PMDATL), split into two banks of
+//  HEF_SLOTS records. A record is appended for every save, so each cell is
+//  erased once per HEF_SLOTS saves; when the bank is full the current
+//  state is compacted into the other bank under the next generation, its
+//  first record written last, and only then is the old bank given up. Keep the area out of the code with
+//  -mreserve=rom@0x780:0x7ff (16F1503) or rom@0x1f80:0x1fff (16F1705).
+//
+//  record  tag  ver<<4 | slot, slot 0 the VFO, 1..MEM_CHS memories,
+//               CAL_SLT and the next the keypad thresholds, 3 each
+//          gen  bank generation
+//          b0   band<<5 | po<<2 | af[1:0]
+//          b1   chan
+//          b2   sq[7:2] | af[3:2]
+//          2 bytes 0xFF, crc8 (poly 07) of the 7 bytes before
+#if defined(_16F1705)
+#define HEF_ADR     0x1F80
+#define HEF_ROW     32      // words per erase row
+#else
+#define HEF_ADR     0x0780
+#define HEF_ROW     16
+#endif
+#define HEF_BNK     64      // words per bank
+#define HEF_REC     8       // words per record
+#define HEF_SLOTS   (HEF_BNK / HEF_REC)
+#define HEF_VER     1
+#define HEF_IDLE    60      // 50ms, 3s without change before a save
+#define CAL_SLT     (MEM_CHS + 1)   // 2 slots, key_thr[]
+#define MEM_HLD     7       // repeats, CT held 1s stores
+
+#ifndef SIM_HOST
+uint8_t hef_rd(uint16_t adr)
+{
+    PMADRH = (uint8_t)(adr >> 8);
+    PMADRL = (uint8_t)adr;
+    PMCON1bits.CFGS = 0;
+    PMCON1bits.RD = 1;
+    NOP();
+    NOP();
+    return PMDATL;
+}
+
+void hef_unlock(void)
+{
+    PMCON2 = 0x55;
+    PMCON2 = 0xAA;
+    PMCON1bits.WR = 1;
+    NOP();
+    NOP();
+}
+
+// one row, CPU stalls about 2ms
+void hef_erase(uint16_t adr)
+{
+    uint8_t gie = GIE;
+
+    GIE = 0;
+    PMADRH = (uint8_t)(adr >> 8);
+    PMADRL = (uint8_t)adr;
+    PMCON1bits.CFGS = 0;
+    PMCON1bits.FREE = 1;
+    PMCON1bits.WREN = 1;
+    hef_unlock();
+    PMCON1bits.WREN = 0;
+    GIE = gie;
+}
+
+// len words inside one row, latches loaded then one 2ms write
+void hef_wr(uint16_t adr, const uint8_t *dat, uint8_t len)
+{
+    uint8_t gie = GIE;
+
+    GIE = 0;
+    PMCON1bits.CFGS = 0;
+    PMCON1bits.FREE = 0;
+    PMCON1bits.WREN = 1;
+    PMCON1bits.LWLO = 1;
+    for(uint8_t lp = 0; lp < len; lp++){
+        PMADRH = (uint8_t)((adr + lp) >> 8);
+        PMADRL = (uint8_t)(adr + lp);
+        PMDATH = 0x3F;
+        PMDATL = dat[lp];
+        if(lp == len - 1){
+            PMCON1bits.LWLO = 0;
+        }
+        hef_unlock();
+    }
+    PMCON1bits.WREN = 0;
+    GIE = gie;
+}
+#endif
+
+uint8_t mem_hld;
+uint8_t hef_bnk;                // bank in use
+uint8_t hef_nxt;                // next free slot in it
+uint8_t hef_gen;
+uint8_t hef_img[3];             // VFO as stored
+uint8_t hef_cur[3];             // VFO as seen last pass
+uint8_t hef_tmr;
+
+uint8_t hef_crc(const uint8_t *dat, uint8_t len)
+{
+    uint8_t crc = 0;
+
+    while(len--){
+        crc ^= *dat++;
+        for(uint8_t lp = 0; lp < 8; lp++){
+            CYC(8);
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+void hef_pack(uint8_t *dat)
+{
+    dat[0] = (uint8_t)((fr_band << 5) | ((po_vol & 7) << 2) | (af_vol & 3));
+    dat[1] = fr_chan;
+    dat[2] = (uint8_t)((sq_vol & 0xFC) | ((af_vol >> 2) & 3));
+}
+
+void hef_unpack(const uint8_t *dat)
+{
+    fr_band = (uint8_t)(dat[0] >> 5);
+    po_vol = (uint8_t)((dat[0] >> 2) & 7);
+    af_vol = (uint8_t)((dat[0] & 3) | ((dat[2] & 3) << 2));
+    fr_chan = dat[1];
+    sq_vol = (uint8_t)(dat[2] & 0xFC);
+    if(fr_band >= BANDS){
+        fr_band = BANDS - 1;
+    }
+    if(fr_chan >= band_chs[fr_band]){
+        fr_chan = 0;
+    }
+    frq_bcd(fr_band, fr_chan, fr_bcd);
+}
+
+uint16_t hef_slot(uint8_t bnk, uint8_t slot)
+{
+    return (uint16_t)(HEF_ADR + bnk * HEF_BNK + slot * HEF_REC);
+}
+
+// 0:valid 1:blank 2:bad
+uint8_t hef_get(uint16_t adr, uint8_t *rec)
+{
+    uint8_t blank = 0xFF;
+
+    for(uint8_t lp = 0; lp < HEF_REC; lp++){
+        rec[lp] = hef_rd(adr + lp);
+        blank &= rec[lp];
+    }
+    if(blank == 0xFF){
+        return 1;
+    }
+    if(((rec[0] >> 4) != HEF_VER) || (hef_crc(rec, HEF_REC - 1) != rec[HEF_REC - 1])){
+        return 2;
+    }
+    return 0;
+}
+
+void hef_rec(uint8_t pos, uint8_t slot, const uint8_t *dat)
+{
+    uint8_t rec[HEF_REC];
+
+    rec[0] = (uint8_t)((HEF_VER << 4) | slot);
+    rec[1] = hef_gen;
+    rec[2] = dat[0];
+    rec[3] = dat[1];
+    rec[4] = dat[2];
+    rec[5] = 0xFF;
+    rec[6] = 0xFF;
+    rec[7] = hef_crc(rec, HEF_REC - 1);
+    hef_wr(hef_slot(hef_bnk, pos), rec, HEF_REC);
+}
+
+// next free position
+void hef_put(uint8_t slot, const uint8_t *dat)
+{
+    hef_rec(hef_nxt++, slot, dat);
+}
+
+// current VFO and memories into the other bank, next generation
+//  hef_load() takes a bank by its first record, so the VFO goes into
+//  position 0 last and commits the bank, a brownout before that leaves
+//  the old one in use.
+void hef_pack_bnk(void)
+{
+    hef_bnk ^= 1;
+    for(uint8_t lp = 0; lp < HEF_BNK; lp += HEF_ROW){
+        hef_erase(hef_slot(hef_bnk, 0) + lp);
+    }
+    hef_gen++;
+    hef_nxt = 1;
+    for(uint8_t lp = 0; lp < MEM_CHS; lp++){
+        if(mem_ch[lp][0] != 0xFF){
+            hef_put((uint8_t)(lp + 1), mem_ch[lp]);
+        }
+    }
+    if(key_hef){
+        hef_put(CAL_SLT, &key_thr[0]);
+        hef_put(CAL_SLT + 1, &key_thr[3]);
+    }
+    hef_pack(hef_img);
+    hef_rec(0, 0, hef_img);
+}
+
+// slot 0 stores the VFO, 1..MEM_CHS the memory, CAL_SLT.. the keypad
+void hef_save(uint8_t slot)
+{
+    uint8_t rec[HEF_REC];
+
+    if((hef_nxt >= HEF_SLOTS) || (hef_get(hef_slot(hef_bnk, hef_nxt), rec) != 1)){
+        hef_pack_bnk();
+        return;
+    }
+    if(slot == 0){
+        hef_pack(hef_img);
+        hef_put(0, hef_img);
+    } else if(slot >= CAL_SLT){
+        hef_put(slot, &key_thr[(slot - CAL_SLT) * 3]);
+    } else {
+        hef_put(slot, mem_ch[slot - 1]);
+    }
+}
+
+// boot, the newer bank is read once in order, the last record of a slot wins
+void hef_load(void)
+{
+    uint8_t rec[HEF_REC];
+    uint8_t thr[KEY_LVLS - 1];
+    uint8_t gen[2];
+    uint8_t ok[2];
+    uint8_t st;
+
+    memset(mem_ch, 0xFF, sizeof(mem_ch));
+    memset(thr, 0, sizeof(thr));
+    for(uint8_t lp = 0; lp < 2; lp++){
+        ok[lp] = (hef_get(hef_slot(lp, 0), rec) == 0);
+        gen[lp] = rec[1];
+    }
+    hef_bnk = (ok[1] && (!ok[0] || ((int8_t)(gen[1] - gen[0]) > 0))) ? 1 : 0;
+    hef_gen = gen[hef_bnk];
+    hef_nxt = 0;
+    if(!ok[hef_bnk]){
+        hef_nxt = HEF_SLOTS;    // blank or foreign, first save compacts
+        hef_pack(hef_img);
+    }
+    while(hef_nxt < HEF_SLOTS){
+        st = hef_get(hef_slot(hef_bnk, hef_nxt), rec);
+        if(st == 1){
+            break;
+        }
+        if((st != 0) || (rec[1] != hef_gen)){
+            hef_nxt = HEF_SLOTS;
+            break;
+        }
+        st = rec[0] & 0x0F;
+        if(st == 0){
+            hef_unpack(&rec[2]);
+            memcpy(hef_img, &rec[2], 3);
+        } else if(st <= MEM_CHS){
+            memcpy(mem_ch[st - 1], &rec[2], 3);
+        } else if(st < CAL_SLT + 2){
+            memcpy(&thr[(st - CAL_SLT) * 3], &rec[2], 3);
+        }
+        hef_nxt++;
+    }
+    memcpy(hef_cur, hef_img, 3);
+    if(key_chk(thr)){
+        memcpy(key_thr, thr, sizeof(thr));
+        key_hef = true;
+    }
+}
+
+// deferred VFO save, once nothing has changed for HEF_IDLE
+void hef_task(void)
+{
+    uint8_t dat[3];
+
+    if((flag != RECV) || (scn_st != SCN_OFF)){
+        hef_tmr = HEF_IDLE;
+        return;
+    }
+    hef_pack(dat);
+    if(memcmp(dat, hef_cur, 3) != 0){
+        memcpy(hef_cur, dat, 3);
+        hef_tmr = HEF_IDLE;
+        return;
+    }
+    if(memcmp(dat, hef_img, 3) == 0){
+        return;
+    }
+    if(--hef_tmr == 0){
+        hef_save(0);
+    }
+}
+
+// memory mode center key, short press recalls, held MEM_HLD repeats stores
+void mem_key(uint8_t evt)
+{
+    if(evt & EVT_PRS){
+        mem_hld = 0;
+    } else if(evt & EVT_RPT){
+        if(++mem_hld == MEM_HLD){
+            led_on(100);
+            hef_pack(mem_ch[mem_sel]);
+            hef_save((uint8_t)(mem_sel + 1));
+        }
+    } else if(evt & EVT_REL){
+        if((mem_hld < MEM_HLD) && (mem_ch[mem_sel][0] != 0xFF)){
+            led_on(10);
+            hef_unpack(mem_ch[mem_sel]);
+        }
+    }
+}
+
+uint8_t chg_mem(uint8_t joys, uint8_t mem_old){
+    uint8_t mem_sel;
+    mem_sel = mem_old;
+        switch (joys){
+            case STAT_DN:
+                led_on(10);
+                if(mem_sel == 0){
+                    mem_sel = MEM_CHS - 1;
+                } else {
+                    mem_sel--;
+                }
+                break ;
+            case STAT_UP:
+                led_on(10);
+                if(mem_sel >= MEM_CHS - 1){
+                    mem_sel = 0;
+                } else {
+                    mem_sel++;
+                }
+                break ;
+            default:
+                ;
+        }
+        return mem_sel;
+}
+
+// Keypad calibration, CT held at power-on
+//  The LCD asks for each key in ladder order, open first. A level is
+//  taken once it has been steady for CAL_STB samples, the midpoints
+//  between neighbours become key_thr[] and go to HEF. Levels closer
+//  than CAL_GAP keep the old thresholds.
+#define CAL_STB     16      // samples, 5ms apart
+#define CAL_TOL     2
+#define CAL_GAP     8
+
+const uint8_t cal_lbl[KEY_LVLS] = "OLRCUDP";
+
+// next level that differs from lvl by more than CAL_GAP and holds
+uint8_t cal_lvl(uint8_t lvl)
+{
+    uint8_t ref = lvl;
+    uint8_t cnt = 0;
+    uint8_t now;
+
+    while(1){
+        __delay_ms(5);
+        now = sw_adc();
+        if((uint8_t)(now - ref + CAL_TOL) > 2 * CAL_TOL){
+            ref = now;
+            cnt = 0;
+        } else if((uint8_t)(ref - lvl + CAL_GAP) > 2 * CAL_GAP){
+            if(++cnt >= CAL_STB){
+                return ref;
+            }
+        }
+    }
+}
+
+void cal_msg(uint8_t chr)
+{
+    lcd_chr('C');
+    lcd_chr('A');
+    lcd_chr('L');
+    lcd_chr(' ');
+    lcd_chr(chr);
+}
+
+// now is the level of CT as held at power-on
+void key_cal(uint8_t now)
+{
+    uint8_t lvl[KEY_LVLS];
+    uint8_t thr[KEY_LVLS - 1];
+    uint8_t ok = true;
+
+    for(uint8_t lp = 0; lp < KEY_LVLS; lp++){
+        cal_msg(cal_lbl[lp]);
+        lcd_out();
+        lvl[lp] = cal_lvl(now);
+        LED_ON;
+        __delay_ms(100);
+        LED_OFF;
+        if(lp != 0){
+            if(lvl[lp] + CAL_GAP >= lvl[lp - 1]){
+                ok = false;     // out of ladder order
+            }
+            cal_lvl(lvl[lp]);   // released
+        }
+        now = lvl[0];
+    }
+    for(uint8_t lp = 0; lp < KEY_LVLS - 1; lp++){
+        thr[lp] = (uint8_t)(lvl[lp + 1] + ((lvl[lp] - lvl[lp + 1]) >> 1));
+    }
+    if(ok && key_chk(thr)){
+        memcpy(key_thr, thr, sizeof(thr));
+        key_map();
+        key_hef = true;
+        hef_save(CAL_SLT);
+        hef_save(CAL_SLT + 1);
+        cal_msg('O');
+        lcd_chr('K');
+    } else {
+        cal_msg('N');
+        lcd_chr('G');
+    }
+    lcd_out();
+    __delay_ms(1000);
+}
+
+// Self-test, only with a key held at power-on
+//  LED blink, LCD init in place, then the keypad calibration for CT or
+//  the joystick echo until released for the others.
+void diag_run(uint8_t lvl){
+    for(uint8_t i = 0; i < 3; i++){
+        LED_ON;
+        __delay_ms(100);
+        LED_OFF;
+        __delay_ms(100);
+    }
+    lcd_init();
+    if(sw_lvl(lvl) == STAT_CT){
+        key_cal(lvl);
+    } else {
+        joys_chk();
+    }
+}
+
+void chg_set(uint8_t joys)
+{
+    switch (set_md){
+        case 1:
+            fr_band = chg_frb(joys, fr_band);
+            frq_bcd(fr_band, fr_chan, fr_bcd);
+            break;
+        case 2:
+            fr_chan = chg_frh(joys, fr_chan, fr_band);
+            break;
+        case 3:
+            fr_chan = chg_frl(joys, fr_chan, fr_band);
+            break;
+        case 4:
+            af_vol = chg_vol(joys, af_vol);
+            break;
+        case 5:
+            sq_vol = chg_sql(joys, sq_vol);
+            break;
+        case 6:
+            po_vol = chg_pow(joys, po_vol);
+            break;
+        case 7:
+            mem_sel = chg_mem(joys, mem_sel);
+            break;
+        default:
+            ;
+    }
+}
+
+// Key repeat, UP/DN held in the menus
+//  In RPT_TSK ticks per menu: the first repeat dly after the press, then
+//  every per, per shortening by acc with every repeat down to min. The
+//  radio keeps the old setting while the key is held, rf_task sends the
+//  final value after the release.
+#define RPT_TSK     5       // ms
+
+typedef struct {
+    uint8_t dly;
+    uint8_t per;
+    uint8_t min;
+    uint8_t acc;
+} rpt_prf;
+
+const rpt_prf rpt_tbl[7] = {
+    {80, 40, 40, 0},    // 1 band
+    {60, 20,  6, 2},    // 2 channel x10
+    {50, 10,  1, 2},    // 3 channel, band in 0.6s
+    {60, 20,  8, 2},    // 4 volume
+    {50, 10,  1, 2},    // 5 squelch, range in 0.6s
+    {80, 40, 40, 0},    // 6 power
+    {80, 40, 40, 0}     // 7 memory
+};
+
+uint8_t rpt_key = STAT_OP;  // key repeating, STAT_OP none
+uint8_t rpt_tmr;
+uint8_t rpt_per;
+
+void rpt_go(uint8_t joys)
+{
+    rpt_key = joys;
+    rpt_tmr = rpt_tbl[set_md - 1].dly;
+    rpt_per = rpt_tbl[set_md - 1].per;
+}
+
+void rpt_task(void)
+{
+    const rpt_prf *prf;
+
+    if(rpt_key == STAT_OP){
+        return;
+    }
+    if((key_now != rpt_key) || (s_timer == 0) || (set_md == 0)){
+        rpt_key = STAT_OP;
+        return;
+    }
+    if(--rpt_tmr != 0){
+        return;
+    }
+    prf = &rpt_tbl[set_md - 1];
+    chg_set(rpt_key);
+    lcd_req = true;
+    rpt_tmr = rpt_per;
+    if(rpt_per > prf->min + prf->acc){
+        rpt_per -= prf->acc;
+    } else {
+        rpt_per = prf->min;
+    }
+}
+
+void key_task(void)
+{
+    uint8_t evt;
+    uint8_t joys;
+
+    while((evt = key_get()) != 0){
+        joys = (uint8_t)(evt & EVT_KEY);
+        if((set_md == 7) && (joys == STAT_CT)){
+            mem_key(evt);
+            s_timer = 50;
+            lcd_req = true;
+            continue;
+        }
+        if((evt & (EVT_PRS | EVT_RPT)) == 0){
+            continue;
+        }
+// Repeats that change nothing are dropped before they redraw the LCD,
+//  CT would toggle the scan, PTT is sending already, UP/DN in RX, RT
+//  past M would toggle the memory scan
+        if(evt & EVT_RPT){
+            if((joys == STAT_CT) || (joys == STAT_PT)){
+                continue;
+            }
+            if((joys == STAT_RT) && ((set_md == 7) || (scn_st != SCN_OFF))){
+                continue;
+            }
+            if(((joys == STAT_UP) || (joys == STAT_DN)) && (set_md == 0) && (scn_st == SCN_OFF)){
+                continue;
+            }
+        }
+
+// Scan, up/down turn round and skip, center and the others stop
+        if(scn_st != SCN_OFF){
+            if((joys == STAT_UP) || (joys == STAT_DN)){
+                scn_dir = (joys == STAT_UP) ? 2 : 0xFE;
+                scn_hop();
+                continue;
+            }
+            scn_st = SCN_OFF;
+            scn_mem = false;
+            lcd_req = true;
+            if(joys == STAT_CT){
+                continue;
+            }
+        }
+
+// Change, UP/DN repeats come from rpt_task
+        if((s_timer > 0) && (set_md != 0)){
+            if((joys == STAT_UP) || (joys == STAT_DN)){
+                if(evt & EVT_RPT){
+                    continue;
+                }
+                rpt_go(joys);
+            }
+            chg_set(joys);
+        }
+
+        switch (joys){
+// left/right
+            case STAT_RT:
+                led_on(10);
+                if(set_md >=7){
+                    set_md = 0;
+                    s_timer = 0;
+                    scn_mem = true;
+                    scn_hop();
+                } else {
+                    set_md++;
+                    s_timer = 50;
+                }
+                break ;
+            case STAT_LT:
+                led_on(10);
                 if(set_md == 0){
                     set_md = 0;
                     s_timer = 0;
@@ -1215,8 +2670,6 @@ void main(void) {
                     set_md--;
                     s_timer = 50;
                 }
-                __delay_ms(120);
-                LED_OFF;
                 break ;
 // up/down
             case STAT_UP:
@@ -1226,38 +2679,293 @@ void main(void) {
                 } else {
                     s_timer = 30;
                 }
-                __delay_ms(80);
+                break ;
+// center, scan from RX, trace dump from the menus
+            case STAT_CT:
+                if(set_md == 0){
+                    scn_hop();
+                }
+#if TRACE
+                else {
+                    trc_dump();
+                }
+#endif
                 break ;
 // SEND
             case STAT_PT:
                 if(flag == RECV){
                     flag = SEND;
-                    lcd_ch(set_md, fr_band, fr_chan);
-                    lcd_txmode();
                     snd_set(fr_band, fr_chan, 7);
                 }
                 s_timer = 0;
                 set_md = 0;
                 break ;
-// RECV
             default:
-//              rcv_set(fr_band, fr_chan, 10, 0x48);
-                rcv_set(fr_band, fr_chan, af_vol, sq_vol);
-                if(flag != RECV){
-                    flag = RECV;
-                    lcd_ch(set_md, fr_band, fr_chan);
-//                  rcv_set(fr_band, fr_chan, 10, 0x48);
-                    rcv_set(fr_band, fr_chan, af_vol, sq_vol);
-                }
-                if(s_timer == 0){
-                    set_md = 0;
-                    lcd_ch(set_md, fr_band, fr_chan);
-//                  rcv_set(fr_band, fr_chan, 10, 0x48);
-                    rcv_set(fr_band, fr_chan, af_vol, sq_vol);
-                } else {
-                    s_timer--;
-                    __delay_ms(50);
-                }
+                ;
         }
+        lcd_req = true;
+    }
+}
+
+// band, channel, volume and squelch rcv_set() had last, 0xFF none
+uint8_t rf_cur[4] = {0xFF};
+
+void rf_task(void)
+{
+    uint8_t now[4];
+
+// RECV
+    if(flag != RECV){
+        if(key_now == STAT_PT){
+            return;
+        }
+        flag = RECV;
+        rf_cur[0] = 0xFF;
+        lcd_req = true;
+    }
+    if((scn_st != SCN_OFF) || (rpt_key != STAT_OP)){
+        return;
+    }
+    now[0] = fr_band;
+    now[1] = fr_chan;
+    now[2] = af_vol;
+    now[3] = sq_vol;
+    if(memcmp(now, rf_cur, sizeof(now)) == 0){
+        return;
+    }
+    memcpy(rf_cur, now, sizeof(now));
+    rcv_set(fr_band, fr_chan, af_vol, sq_vol);
+}
+
+void lcd_task(void)
+{
+    uint8_t bcd[3];
+
+    if(lcd_stg != LCD_RDY){
+        lcd_boot();
+        return;
+    }
+    if(lcd_req == false){
+        return;
+    }
+    lcd_req = false;
+    switch (set_md){
+        case 4:
+            lcd_fnc(set_md, af_vol);
+            break;
+        case 5:
+            lcd_fnc(set_md, sq_vol);
+            break;
+        case 6:
+            lcd_fnc(set_md, po_vol);
+            break;
+        case 7:
+            // "M2:433.0", the last digit gives way to the memory number
+            lcd_chr('M');
+            lcd_chr((uint8_t)('1' + mem_sel));
+            lcd_chr(':');
+            if(mem_ch[mem_sel][0] == 0xFF){
+                lcd_chr('-');
+            } else {
+                frq_bcd((uint8_t)(mem_ch[mem_sel][0] >> 5), mem_ch[mem_sel][1], bcd);
+                lcd_frq(bcd);
+            }
+            lcd_out();
+            break;
+        default:
+            if(flag == SEND){
+                lcd_ch(9, fr_bcd);
+            } else {
+                lcd_ch((scn_st == SCN_OFF) ? set_md : (scn_mem ? 10 : 8), fr_bcd);
+            }
+    }
+}
+
+void menu_task(void)
+{
+    if((key_now != STAT_OP) && (key_now != STAT_CT)){
+        return;
+    }
+    if(s_timer > 0){
+        if(--s_timer == 0){
+            set_md = 0;
+            lcd_req = true;
+        }
+    }
+}
+
+sch_task sch_tsk[] = {
+    {key_task,   5, 0, 0, 0},
+    {rf_task,   10, 0, 0, 0},
+    {lcd_task,  LCD_TSK, 0, 0, 0},
+    {led_task,   1, 0, 0, 0},
+    {menu_task, 50, 0, 0, 0},
+    {scn_task,   1, 0, 0, 0},
+    {hef_task,  50, 0, 0, 0},
+    {rpt_task,  RPT_TSK, 0, 0, 0}
+};
+#define SCH_TSKS    (sizeof(sch_tsk) / sizeof(sch_tsk[0]))
+
+void sch_init(void)
+{
+    T1CON = 0b00000001;     // Fosc/4 1:1 ON
+    for(uint8_t lp = 0; lp < SCH_TSKS; lp++){
+        sch_tsk[lp].nxt = tick_ms;
+    }
+}
+
+void sch_run(void)
+{
+    uint16_t t_run;
+
+    for(uint8_t lp = 0; lp < SCH_TSKS; lp++){
+        CYC(12);
+        if((int8_t)(tick_ms - sch_tsk[lp].nxt) < 0){
+            continue;
+        }
+        CYC(40);
+        sch_tsk[lp].nxt += sch_tsk[lp].per;
+        TRC(TRC_TSK + lp);
+        t_run = tmr1_get();
+        sch_tsk[lp].fn();
+        t_run = tmr1_get() - t_run;
+        TRC_RUN(TRC_TSK + lp + TRC_END, t_run);
+        sch_tsk[lp].run = t_run;
+        if(t_run > sch_tsk[lp].max){
+            sch_tsk[lp].max = t_run;
+        }
+    }
+}
+
+// any task at or past its deadline
+uint8_t sch_due(void)
+{
+    for(uint8_t lp = 0; lp < SCH_TSKS; lp++){
+        CYC(12);
+        if((int8_t)(tick_ms - sch_tsk[lp].nxt) >= 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+// Idle power manager
+//  With the menu timed out, no key down or queued, the LED off and the
+//  LCD and bus quiet, pwr_idle() puts the CPU to SLEEP. The WDT wakes it
+//  every PWR_WDT ms, IOC at once on a falling RA2, which is digital while
+//  asleep (PTT and DN pull the ladder below VIL). Timer0 stops in SLEEP,
+//  a WDT wake adds PWR_WDT to tick_ms. The ADC sample taken on wake goes
+//  to the debouncer, a key keeps the CPU awake until it is released.
+//  After a WDT wake the tasks faster than PWR_WDT run once, the slower
+//  ones catch up, all before the next SLEEP. rf_task only calls
+//  rcv_set() when a setting has changed.
+#ifndef PWR_SLP
+#define PWR_SLP     1       // 0:spin
+#endif
+#define PWR_WDTPS   0b00100 // 1:512
+#define PWR_WDT     16      // ms
+
+// after a WDT wake the pollers faster than the wake run once, not once
+// for every period slept through; the slower tasks catch up as usual
+void sch_skip(void)
+{
+    for(uint8_t lp = 0; lp < SCH_TSKS; lp++){
+        CYC(12);
+        if(sch_tsk[lp].per < PWR_WDT){
+            sch_tsk[lp].nxt = tick_ms;
+        }
+    }
+}
+
+void pwr_idle(void)
+{
+#if PWR_SLP
+    CYC(30);
+    if((key_now != STAT_OP) || (key_raw != STAT_OP) || (key_qh != key_qt)
+            || (s_timer != 0) || (flag != RECV) || (scn_st != SCN_OFF)
+            || (led_tmr != 0) || (lcd_stg != LCD_RDY) || lcd_req
+            || (i2c_st != I2C_IDLE) || sch_due()){
+        return;
+    }
+#if I2C_HW
+    i2c_idle();
+#endif
+    GIE = 0;
+    while(ADC_BUSY()) ;
+    ANSELA  = 0b00000000;   // RA2 digital
+    IOCAF   = 0;
+    IOCAN   = 0b00000100;   // RA2 falling edge
+    IOCIE   = 1;
+    WDTCON  = (PWR_WDTPS << 1) | 1;     // SWDTEN
+    SLEEP();
+    NOP();
+    WDTCON  = PWR_WDTPS << 1;
+    IOCIE   = 0;
+    IOCAN   = 0;
+    IOCAF   = 0;
+    ANSELA  = 0b00000100;   // AN2
+    if(nTO == 0){
+        tick_ms += PWR_WDT;
+        sch_skip();
+    }
+    key_smp(sw_state());
+    ADIF = 0;
+    GIE = 1;
+#endif
+}
+
+void __interrupt() isr(void)
+{
+    CYC(20);        // context save and restore
+    if(TMR0IF){
+        TMR0IF = 0;
+        TMR0 += TMR0_RLD;
+        tick_ms++;
+        if(++key_div >= KEY_SMP){
+            key_div = 0;
+            ADC_START();
+        }
+#if !I2C_HW
+        if((i2c_st != I2C_IDLE) && !i2c_lck){
+            i2c_one();
+        }
+#endif
+    }
+    if(ADIF){
+        ADIF = 0;
+        key_smp(sw_lvl((uint8_t)((((uint16_t)ADRESH << 8) | ADRESL) >> 2)));
+    }
+#if I2C_HW
+    if(SSP1IF){
+        SSP1IF = 0;
+        i2c_step();
+    }
+#endif
+}
+
+void main(void) {
+    uint8_t lvl;
+
+//Initialize
+//  radio first, the LCD powers up from lcd_task meanwhile
+    port_init();
+    i2c_init();
+    hef_load();
+    frq_bcd(fr_band, fr_chan, fr_bcd);
+    key_map();
+    bk_init(rcv_reg);
+    rcv_set(fr_band, fr_chan, af_vol, sq_vol);
+    lvl = sw_adc();
+    if(sw_lvl(lvl) != STAT_OP){
+        diag_run(lvl);
+    }
+    key_init();
+    sch_init();
+
+//Loop
+    while(1){
+        sch_run();
+        pwr_idle();
+        HAL_IDLE();
     }
 }